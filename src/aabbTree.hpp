@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "al/math/al_Vec.hpp"
+
+using namespace al;
+
+class Object;
+
+struct AABBTreeNode
+{
+    Vec3f min, max; // fattened bounds for leaves
+    Object *object = nullptr;
+    int tag = -1; // caller's index of the object
+    int parent = -1; // next free node while unused
+    int left = -1;
+    int right = -1;
+    int height = -1; // 0 for leaves, -1 when free
+
+    bool isLeaf() const { return left == -1; }
+};
+
+// Dynamic bounding volume hierarchy over fat AABBs. A proxy is only
+// reinserted when its object leaves the fat box. Inserts pick the sibling by
+// surface area and every refit rotates the taller grandchild up, which keeps
+// the tree close to balanced, so queries stay logarithmic.
+class AABBTree
+{
+public:
+    std::vector<AABBTreeNode> nodes;
+    int root = -1;
+    float margin = 0.1f; // fat box padding
+    float displacementFactor = 4.0f; // fat box stretched along the motion
+
+    int createProxy(Vec3f min, Vec3f max, Object *object, int tag = -1)
+    {
+        int proxy = allocateNode();
+        Vec3f pad(margin);
+        nodes[proxy].min = min - pad;
+        nodes[proxy].max = max + pad;
+        nodes[proxy].object = object;
+        nodes[proxy].tag = tag;
+        nodes[proxy].height = 0;
+        insertLeaf(proxy);
+        return proxy;
+    }
+
+    void destroyProxy(int proxy)
+    {
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+
+    // true when the proxy had to be reinserted
+    bool moveProxy(int proxy, Vec3f min, Vec3f max, Vec3f displacement)
+    {
+        auto &node = nodes[proxy];
+        if (contains(node.min, node.max, min, max))
+        {
+            // still inside, unless the fat box has become far too big
+            Vec3f bigMin = min - Vec3f(4 * margin), bigMax = max + Vec3f(4 * margin);
+            for (int i = 0; i < 3; i++)
+            {
+                float d = displacementFactor * displacement[i];
+                if (d < 0)
+                    bigMin[i] += d;
+                else
+                    bigMax[i] += d;
+            }
+            if (contains(bigMin, bigMax, node.min, node.max))
+                return false;
+        }
+        removeLeaf(proxy);
+        Vec3f pad(margin);
+        min -= pad;
+        max += pad;
+        for (int i = 0; i < 3; i++)
+        {
+            float d = displacementFactor * displacement[i];
+            if (d < 0)
+                min[i] += d;
+            else
+                max[i] += d;
+        }
+        nodes[proxy].min = min;
+        nodes[proxy].max = max;
+        insertLeaf(proxy);
+        return true;
+    }
+
+    Object *object(int proxy) const { return nodes[proxy].object; }
+    int tag(int proxy) const { return nodes[proxy].tag; }
+    int height() const { return root == -1 ? 0 : nodes[root].height; }
+
+    // fn(proxy) for every proxy whose fat box overlaps [min, max]
+    template <class F>
+    void query(Vec3f min, Vec3f max, F fn) const
+    {
+        if (root == -1)
+            return;
+        int local[stackSize];
+        std::vector<int> heap;
+        int *stack = traversalStack(local, heap);
+        int count = 0;
+        stack[count++] = root;
+        while (count > 0)
+        {
+            int id = stack[--count];
+            auto &node = nodes[id];
+            if (!overlap(node.min, node.max, min, max))
+                continue;
+            if (node.isLeaf())
+            {
+                fn(id);
+            }
+            else
+            {
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    }
+
+    // fn(proxy, t) for proxies whose fat box the ray enters at t <= maxT.
+    // fn returns the new maxT, so returning a hit distance clips the ray
+    template <class F>
+    void rayCast(Vec3f origin, Vec3f dir, float maxT, F fn) const
+    {
+        if (root == -1)
+            return;
+        Vec3f invDir;
+        for (int i = 0; i < 3; i++)
+            invDir[i] = 1.0f / dir[i];
+        int local[stackSize];
+        std::vector<int> heap;
+        int *stack = traversalStack(local, heap);
+        int count = 0;
+        stack[count++] = root;
+        while (count > 0)
+        {
+            int id = stack[--count];
+            auto &node = nodes[id];
+            float t = rayBox(origin, invDir, node.min, node.max, maxT);
+            if (t < 0)
+                continue;
+            if (node.isLeaf())
+            {
+                maxT = fn(id, t);
+            }
+            else
+            {
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    }
+
+    // fn(a, b) once for every pair of proxies with overlapping fat boxes
+    template <class F>
+    void queryPairs(F fn) const
+    {
+        for (int id = 0; id < nodes.size(); id++)
+        {
+            if (nodes[id].height != 0)
+                continue;
+            query(nodes[id].min, nodes[id].max, [&](int other) {
+                if (other > id)
+                    fn(id, other);
+            });
+        }
+    }
+
+private:
+    int freeList = -1;
+
+    // A depth first walk holds at most one pending sibling per level, so
+    // height() + 1 entries. The balancing keeps the height near 1.44 log2 of
+    // the proxy count, so the fixed array on the stack always fits in
+    // practice; heap is only there for a degenerate tree.
+    static const int stackSize = 64;
+    int *traversalStack(int *local, std::vector<int> &heap) const
+    {
+        if (height() < stackSize)
+            return local;
+        heap.resize(height() + 1);
+        return heap.data();
+    }
+
+    static bool contains(const Vec3f &outerMin, const Vec3f &outerMax, const Vec3f &min, const Vec3f &max)
+    {
+        return outerMin.x <= min.x && outerMin.y <= min.y && outerMin.z <= min.z &&
+               max.x <= outerMax.x && max.y <= outerMax.y && max.z <= outerMax.z;
+    }
+
+    static bool overlap(const Vec3f &minA, const Vec3f &maxA, const Vec3f &minB, const Vec3f &maxB)
+    {
+        return minA.x <= maxB.x && minB.x <= maxA.x && minA.y <= maxB.y && minB.y <= maxA.y &&
+               minA.z <= maxB.z && minB.z <= maxA.z;
+    }
+
+    static float area(const Vec3f &min, const Vec3f &max)
+    {
+        Vec3f d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static float unionArea(const AABBTreeNode &a, const AABBTreeNode &b)
+    {
+        Vec3f min(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z));
+        Vec3f max(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z));
+        return area(min, max);
+    }
+
+    // slab test, entry distance or -1 on a miss
+    static float rayBox(const Vec3f &origin, const Vec3f &invDir, const Vec3f &min, const Vec3f &max, float maxT)
+    {
+        float tMin = 0, tMax = maxT;
+        for (int i = 0; i < 3; i++)
+        {
+            float t0 = (min[i] - origin[i]) * invDir[i];
+            float t1 = (max[i] - origin[i]) * invDir[i];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            if (tMin > tMax)
+                return -1;
+        }
+        return tMin;
+    }
+
+    int allocateNode()
+    {
+        if (freeList == -1)
+        {
+            nodes.emplace_back();
+            return nodes.size() - 1;
+        }
+        int id = freeList;
+        freeList = nodes[id].parent;
+        nodes[id] = AABBTreeNode();
+        return id;
+    }
+
+    void freeNode(int id)
+    {
+        nodes[id] = AABBTreeNode();
+        nodes[id].parent = freeList;
+        freeList = id;
+    }
+
+    void refit(int id)
+    {
+        auto &node = nodes[id];
+        auto &left = nodes[node.left];
+        auto &right = nodes[node.right];
+        for (int i = 0; i < 3; i++)
+        {
+            node.min[i] = std::min(left.min[i], right.min[i]);
+            node.max[i] = std::max(left.max[i], right.max[i]);
+        }
+        node.height = 1 + std::max(left.height, right.height);
+    }
+
+    void insertLeaf(int leaf)
+    {
+        if (root == -1)
+        {
+            root = leaf;
+            nodes[root].parent = -1;
+            return;
+        }
+
+        // walk down to the cheapest sibling by surface area
+        int index = root;
+        while (!nodes[index].isLeaf())
+        {
+            auto &node = nodes[index];
+            float nodeArea = area(node.min, node.max);
+            float combined = unionArea(node, nodes[leaf]);
+            float cost = 2 * combined;
+            float inheritance = 2 * (combined - nodeArea);
+
+            float childCost[2];
+            int children[2] = {node.left, node.right};
+            for (int c = 0; c < 2; c++)
+            {
+                auto &child = nodes[children[c]];
+                if (child.isLeaf())
+                    childCost[c] = unionArea(child, nodes[leaf]) + inheritance;
+                else
+                    childCost[c] = unionArea(child, nodes[leaf]) - area(child.min, child.max) + inheritance;
+            }
+            if (cost < childCost[0] && cost < childCost[1])
+                break;
+            index = childCost[0] < childCost[1] ? children[0] : children[1];
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent == -1)
+        {
+            root = newParent;
+        }
+        else if (nodes[oldParent].left == sibling)
+        {
+            nodes[oldParent].left = newParent;
+        }
+        else
+        {
+            nodes[oldParent].right = newParent;
+        }
+
+        for (index = newParent; index != -1; index = nodes[index].parent)
+        {
+            index = balance(index);
+            refit(index);
+        }
+    }
+
+    void removeLeaf(int leaf)
+    {
+        if (leaf == root)
+        {
+            root = -1;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+        if (grandParent == -1)
+        {
+            root = sibling;
+            nodes[sibling].parent = -1;
+            freeNode(parent);
+            return;
+        }
+        if (nodes[grandParent].left == parent)
+            nodes[grandParent].left = sibling;
+        else
+            nodes[grandParent].right = sibling;
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        for (int index = grandParent; index != -1; index = nodes[index].parent)
+        {
+            index = balance(index);
+            refit(index);
+        }
+    }
+
+    // rotate the taller grandchild up when the children differ in height by
+    // more than one, returns the node now at this position
+    int balance(int a)
+    {
+        if (nodes[a].isLeaf() || nodes[a].height < 2)
+            return a;
+        int b = nodes[a].left;
+        int c = nodes[a].right;
+        int diff = nodes[c].height - nodes[b].height;
+        if (diff > 1)
+            return rotate(a, c, false);
+        if (diff < -1)
+            return rotate(a, b, true);
+        return a;
+    }
+
+    // up is the taller child of a
+    int rotate(int a, int up, bool upIsLeft)
+    {
+        int f = nodes[up].left;
+        int g = nodes[up].right;
+
+        // up takes a's place
+        nodes[up].left = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+        if (nodes[up].parent == -1)
+            root = up;
+        else if (nodes[nodes[up].parent].left == a)
+            nodes[nodes[up].parent].left = up;
+        else
+            nodes[nodes[up].parent].right = up;
+
+        // the taller grandchild stays under up, the other moves to a
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int move = keep == f ? g : f;
+        nodes[up].right = keep;
+        if (upIsLeft)
+            nodes[a].left = move;
+        else
+            nodes[a].right = move;
+        nodes[move].parent = a;
+
+        refit(a);
+        refit(up);
+        return up;
+    }
+};
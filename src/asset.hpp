@@ -0,0 +1,101 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "al/graphics/al_Mesh.hpp"
+#include "al/graphics/al_Shader.hpp"
+#include "al/graphics/al_Shapes.hpp"
+#include "al/graphics/al_DefaultShaders.hpp"
+#include "al/graphics/al_DefaultShaderString.hpp"
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Texture.hpp"
+#include "loader.hpp"
+
+using namespace al;
+
+// Everything an Object draws with that does not depend on the instance.
+// Objects loaded from the same files share one of these.
+struct ObjectAsset
+{
+    Mesh mesh;
+    Texture texture;
+    ShaderProgram shader;
+
+    BufferObject bufferArray[3];
+    BufferObject elementBuffer;
+    VAO vao;
+    bool uploaded = false; // GL buffers filled by the first V1Object::onCreate
+    bool normalsGenerated = false;
+};
+
+void loadMesh(Mesh &mesh, const std::string meshPath)
+{
+    if (!strcmp(meshPath.c_str(), "")) {
+        addSphere(mesh);
+    } else {
+        std::vector<Vec3f> vertices;
+        std::vector<Vec2f> uvs;
+        std::vector<Vec3f> normals;
+        loadOBJ(meshPath.c_str(), vertices, uvs, normals);
+        indexVBO(vertices, uvs, normals, mesh.indices(), mesh.vertices(), mesh.texCoord2s(), mesh.normals());
+    }
+}
+
+void loadShader(ShaderProgram &shader, const std::string shaderPath)
+{
+    if (!strcmp(shaderPath.c_str(), "")) {
+        al::ShaderSources un = al::defaultShaderUniformColor(false, false, false);
+        shader.compile(un.vert.c_str(), un.frag.c_str());
+    } else {
+        std::fstream vert(std::string(shaderPath + ".vert").c_str(), std::ios::in);
+        std::fstream frag(std::string(shaderPath + ".frag").c_str(), std::ios::in);
+        std::stringstream vertStr;
+        std::stringstream fragStr;
+        if (!vert.good() || !frag.good()) {
+            std::cout<<"ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
+        }
+        vertStr << vert.rdbuf();
+        fragStr << frag.rdbuf();
+        if (!shader.compile(vertStr.str().c_str(), fragStr.str().c_str())) {
+            std::cout<<"ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
+        }
+        vert.close();
+        frag.close();
+    }
+}
+
+std::shared_ptr<ObjectAsset> createObjectAsset(const std::string meshPath, const std::string shaderPath,
+                                               const std::string texPath)
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, meshPath);
+    loadShader(asset->shader, shaderPath);
+    if (!strcmp(texPath.c_str(), "")) {
+        // pass
+    } else {
+        loadTexture(asset->texture, texPath);
+    }
+    return asset;
+}
+
+// Returns the asset already loaded from these files if an instance still
+// holds it. Objects without a mesh file (sphere, cloth) get their own copy,
+// since they usually rewrite the mesh.
+std::shared_ptr<ObjectAsset> loadObjectAsset(const std::string meshPath, const std::string shaderPath,
+                                             const std::string texPath)
+{
+    if (!strcmp(meshPath.c_str(), ""))
+        return createObjectAsset(meshPath, shaderPath, texPath);
+
+    static std::map<std::string, std::weak_ptr<ObjectAsset>> loaded;
+    std::string key = meshPath + "|" + shaderPath + "|" + texPath;
+    auto asset = loaded[key].lock();
+    if (!asset) {
+        asset = createObjectAsset(meshPath, shaderPath, texPath);
+        loaded[key] = asset;
+    }
+    return asset;
+}
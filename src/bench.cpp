@@ -0,0 +1,1756 @@
+// Offline benchmarks for the physics code, no window or GL context needed.
+// usage: ./bin/app_bench [name ...]   (no name runs everything)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aabbTree.hpp"
+#include "asset.hpp"
+#include "clothSolver.hpp"
+#include "contactSolver.hpp"
+#include "convexHull.hpp"
+#include "distanceField.hpp"
+#include "fixedTimestep.hpp"
+#include "octree.hpp"
+#include "physicsObject.hpp"
+#include "physicsThread.hpp"
+#include "physicsWorld.hpp"
+#include "rigidBodies.hpp"
+#include "simdKernels.hpp"
+#include "spatialHash.hpp"
+#include "staticColliders.hpp"
+
+using namespace al;
+
+// every heap allocation of the program, for the allocation-free checks.
+// noinline: inlined, GCC sees free() on pointers from operator new and
+// warns about a mismatch that is not one
+std::atomic<long> allocations{0};
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Timer
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    double ms() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
+
+void meshBounds(Mesh &mesh, Vec3f &min, Vec3f &max)
+{
+    min = Vec3f(9999, 9999, 9999);
+    max = Vec3f(-9999, -9999, -9999);
+    for (auto &vert : mesh.vertices())
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (vert[i] < min[i])
+                min[i] = vert[i];
+            if (vert[i] > max[i])
+                max[i] = vert[i];
+        }
+    }
+}
+
+// pointer OctreeNode tree against LinearOctree on the bunny
+void benchOctree()
+{
+    Mesh mesh;
+    loadMesh(mesh, "./assets/bunny/bunny.obj");
+    Vec3f min, max;
+    meshBounds(mesh, min, max);
+    const int runs = 20;
+
+    for (int depth = 4; depth <= 6; depth++)
+    {
+        double legacyMs = 0, linearMs = 0;
+        size_t legacyBytes = 0, linearBytes = 0, legacyLeaves = 0, linearLeaves = 0;
+        int legacyNodes = 0, linearNodes = 0;
+        for (int run = 0; run < runs; run++)
+        {
+            Timer t;
+            OctreeNode *root = new OctreeNode();
+            root->depth = 1;
+            createMeshOctree(root, mesh, min.x, max.x, min.y, max.y, min.z, max.z, depth);
+            Mesh leaves;
+            octreeToMesh(root, leaves, depth);
+            legacyNodes = nodeNum(root);
+            deleteTree(root);
+            legacyMs += t.ms();
+            legacyLeaves = leaves.vertices().size();
+            legacyBytes = legacyNodes * sizeof(OctreeNode);
+        }
+        for (int run = 0; run < runs; run++)
+        {
+            Timer t;
+            LinearOctree octree;
+            createLinearOctree(octree, mesh, min, max, depth);
+            Mesh leaves;
+            linearOctreeToMesh(octree, leaves);
+            linearNodes = octree.nodes.size();
+            linearBytes = octree.memoryBytes();
+            octree.clear();
+            linearMs += t.ms();
+            linearLeaves = leaves.vertices().size();
+        }
+        std::cout << "octree depth " << depth << " (" << mesh.vertices().size() << " vertices)\n"
+                  << "  pointer: " << legacyMs / runs << " ms, " << legacyNodes << " nodes, "
+                  << legacyBytes << " bytes (+1 heap block per node), " << legacyLeaves << " leaves\n"
+                  << "  linear:  " << linearMs / runs << " ms, " << linearNodes << " nodes, "
+                  << linearBytes << " bytes, " << linearLeaves << " leaves" << std::endl;
+    }
+}
+
+// deep trees on a dense synthetic surface, only the partitioning builder
+void benchDeepOctree()
+{
+    Mesh mesh;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> normal;
+    for (int i = 0; i < 2000000; i++)
+    {
+        Vec3f p(normal(rng), normal(rng), normal(rng));
+        mesh.vertex(p.normalize());
+    }
+    Vec3f min, max;
+    meshBounds(mesh, min, max);
+    for (int depth = 6; depth <= 14; depth += 2)
+    {
+        LinearOctree octree;
+        Timer serial;
+        createLinearOctree(octree, mesh, min, max, depth, SIZE_MAX);
+        double serialMs = serial.ms();
+        Timer parallel;
+        createLinearOctree(octree, mesh, min, max, depth);
+        double parallelMs = parallel.ms();
+        std::cout << "deep octree depth " << depth << " (" << mesh.vertices().size() << " vertices): "
+                  << serialMs << " ms serial, " << parallelMs << " ms on "
+                  << ThreadPool::instance().size() << " threads, " << octree.nodes.size() << " nodes, "
+                  << octree.leafEnd() - octree.leafBegin() << " leaves, "
+                  << octree.memoryBytes() / 1024 << " KiB" << std::endl;
+    }
+}
+
+// what createAABBAndOctrees does for a batch of new bodies
+void benchBatchOctree()
+{
+    const int num = 32;
+    Mesh bunny;
+    loadMesh(bunny, "./assets/bunny/bunny.obj");
+    std::vector<Mesh> meshes(num);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> jitter(-1e-3f, 1e-3f);
+    for (auto &mesh : meshes)
+    {
+        // a denser copy of the bunny per body
+        for (int copy = 0; copy < 16; copy++)
+            for (auto &vert : bunny.vertices())
+                mesh.vertex(vert + Vec3f(jitter(rng), jitter(rng), jitter(rng)));
+    }
+    std::vector<LinearOctree> octrees(num);
+    auto build = [&](int i) {
+        Vec3f min, max;
+        meshBounds(meshes[i], min, max);
+        createLinearOctree(octrees[i], meshes[i], min, max, 8);
+    };
+
+    Timer serial;
+    for (int i = 0; i < num; i++)
+        build(i);
+    double serialMs = serial.ms();
+    Timer parallel;
+    ThreadPool::instance().parallelFor(num, build);
+    double parallelMs = parallel.ms();
+    std::cout << num << " bodies x " << meshes[0].vertices().size() << " vertices, depth 8: "
+              << serialMs << " ms one by one, " << parallelMs << " ms batched on "
+              << ThreadPool::instance().size() << " threads" << std::endl;
+}
+
+// old rigidBodyCollision point set (every leaf center against the whole
+// AABB) against collideLinearOctrees, for one pair of bunnies: the descent
+// (a copy without the leaf grids), the grid loops, and the grid loops
+// stopping at the first pair of each leaf as contactImpulse does
+void benchNarrowphase()
+{
+    Mesh mesh;
+    loadMesh(mesh, "./assets/bunny/bunny.obj");
+    Vec3f min, max;
+    meshBounds(mesh, min, max);
+    const int runs = 2000;
+    for (int depth = 4; depth <= 6; depth++)
+    {
+        LinearOctree octree;
+        createLinearOctree(octree, mesh, min, max, depth);
+        LinearOctree descent = octree;
+        descent.leafGrid.clear();
+        descent.leafCenters.clear();
+        Mesh centers;
+        linearOctreeToMesh(octree, centers);
+        std::cout << "depth " << depth << ", " << centers.vertices().size() << " leaves" << std::endl;
+        // b is a copy of a moved along x, from deep overlap to just touching,
+        // off the cell boundaries so leaves do not only touch
+        Vec3f cell = octree.cellSize(depth);
+        for (float shift : {0.5f, 0.8f, 0.95f, 1.1f})
+        {
+            Mat4f toObject = Mat4f::identity();
+            toObject[12] = (max.x - min.x) * shift + cell.x * 0.3f;
+            toObject[13] = (max.y - min.y) * 0.1f;
+            toObject[14] = cell.z * 0.2f;
+
+            size_t bruteContacts = 0;
+            Timer brute;
+            for (int run = 0; run < runs; run++)
+            {
+                bruteContacts = 0;
+                for (auto &vert : centers.vertices())
+                {
+                    if (inBox(Vec3f(toObject * Vec4f(vert, 1.0f)), min, max))
+                        bruteContacts++;
+                }
+            }
+            double bruteMs = brute.ms() / runs;
+
+            std::vector<std::pair<uint32_t, uint32_t>> leafPairs;
+            std::vector<uint32_t> contactLeaves;
+            OctreePairScratch scratch;
+            auto time = [&](const LinearOctree &tree, bool firstPerLeaf, size_t &pairs) {
+                Timer t;
+                for (int run = 0; run < runs; run++)
+                {
+                    collideLinearOctrees(tree, tree, toObject, leafPairs, scratch, firstPerLeaf);
+                    contactLeaves.clear();
+                    for (auto &pair : leafPairs)
+                        contactLeaves.push_back(pair.first);
+                    std::sort(contactLeaves.begin(), contactLeaves.end());
+                    contactLeaves.erase(std::unique(contactLeaves.begin(), contactLeaves.end()),
+                                        contactLeaves.end());
+                }
+                pairs = leafPairs.size();
+                return t.ms() / runs;
+            };
+            size_t descentPairs, gridPairs, firstPairs;
+            double descentMs = time(descent, false, descentPairs);
+            double gridMs = time(octree, false, gridPairs);
+            double firstMs = time(octree, true, firstPairs);
+            std::cout << "  overlap " << 1 - shift << ": brute " << bruteMs * 1000 << " us, " << bruteContacts
+                      << " contacts | descent " << descentMs * 1000 << " us, " << descentPairs << " leaf pairs | grid "
+                      << gridMs * 1000 << " us, " << gridPairs << " leaf pairs | first per leaf " << firstMs * 1000
+                      << " us, " << contactLeaves.size() << " contacts" << std::endl;
+        }
+    }
+}
+
+size_t meshBytes(Mesh &mesh)
+{
+    return mesh.vertices().capacity() * sizeof(Vec3f) + mesh.normals().capacity() * sizeof(Vec3f) +
+           mesh.texCoord2s().capacity() * sizeof(Vec2f) + mesh.indices().capacity() * sizeof(Mesh::Index);
+}
+
+// CPU side of createBunny: first instance loads the asset, the rest share it
+void benchSpawn()
+{
+    // GL parts (shader, texture, buffers) need a context and are left out
+    auto asset = std::make_shared<ObjectAsset>();
+    std::vector<std::shared_ptr<RigidObject>> bunnys;
+    PhysicsWorld world;
+    for (int i = 0; i < 1000; i++)
+    {
+        Timer t;
+        if (i == 0)
+            loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+        auto bunny = std::make_shared<RigidObject>(asset);
+        bunny->scale = Vec3f(0.005);
+        bunny->computeAABBAndOctree();
+        world.addBody(bunny);
+        bunnys.push_back(bunny);
+        if (i == 0 || i == 1 || i == 999)
+            std::cout << "spawn #" << i + 1 << ": " << t.ms() << " ms" << std::endl;
+    }
+    auto &rigid = *bunnys[0]->rigidAsset;
+    size_t shared = sizeof(ObjectAsset) + meshBytes(asset->mesh) + sizeof(RigidAsset) +
+                    rigid.octree.memoryBytes() + meshBytes(rigid.octreeMesh) + meshBytes(rigid.AABB);
+    std::cout << "shared asset: " << shared << " bytes (+ GL buffers and texture), per instance: "
+              << sizeof(RigidObject) << " bytes" << std::endl;
+}
+
+// the floor and walls of main.cpp
+void addRoom(StaticColliderSet &colliders)
+{
+    colliders.addPlane(Vec3f(0, -1.5f, 0), Vec3f(0, 1, 0));
+    colliders.addPlane(Vec3f(15.0f, 0, 0), Vec3f(-1, 0, 0));
+    colliders.addPlane(Vec3f(-15.0f, 0, 0), Vec3f(1, 0, 0));
+    colliders.addPlane(Vec3f(0, 0, 15.0f), Vec3f(0, 0, -1));
+    colliders.addPlane(Vec3f(0, 0, -15.0f), Vec3f(0, 0, 1));
+}
+
+// layers of 10 x 10 bunnies (2.5 wide) over the floor of the room, ready to drop
+void createBunnyPile(PhysicsWorld &world, std::shared_ptr<ObjectAsset> asset, int num)
+{
+    addRoom(world.colliders);
+    std::mt19937 rng(num);
+    std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+    int side = 10;
+    for (int i = 0; i < num; i++)
+    {
+        auto bunny = std::make_shared<RigidObject>(asset);
+        bunny->scale = Vec3f(0.005);
+        bunny->computeAABBAndOctree();
+        bunny->nav.pos(-12.15f + 2.7f * (i % side) + jitter(rng), 2.7f * (i / (side * side)) + jitter(rng),
+                       -12.15f + 2.7f * (i / side % side) + jitter(rng));
+        bunny->nav.quat().fromAxisAngle(-0.5 * M_2PI, 1, 0, 0);
+        world.addBody(bunny);
+    }
+}
+
+// full rigid step of a bunny pile, sweep and prune against testing every pair
+void benchBroadphase()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    const int steps = 60;
+    for (int num : {1000, 2000, 4000})
+    {
+        PhysicsWorld world;
+        createBunnyPile(world, asset, num);
+
+        double broadMs = 0, narrowMs = 0, integrateMs = 0;
+        size_t pairs = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            Timer broad;
+            world.updateBroadphase();
+            broadMs += broad.ms();
+            Timer narrow;
+            world.narrowphase();
+            narrowMs += narrow.ms();
+            Timer integrate;
+            world.integrate(0.016f);
+            integrateMs += integrate.ms();
+            pairs += world.pairs.size();
+        }
+        std::cout << num << " bodies: step " << (broadMs + narrowMs + integrateMs) / steps << " ms (broadphase "
+                  << broadMs / steps << " ms, narrowphase " << narrowMs / steps << " ms, integrate "
+                  << integrateMs / steps << " ms), " << pairs / steps << " pairs per step" << std::endl;
+
+        if (num == 1000)
+        {
+            // what the old main loop did: every ordered pair to the narrowphase
+            Timer all;
+            for (auto &a : world.bodies)
+            {
+                for (auto &b : world.bodies)
+                {
+                    if (a != b)
+                        a->rigidBodyCollision(*b);
+                }
+            }
+            std::cout << "  all pairs narrowphase: " << all.ms() << " ms per step" << std::endl;
+            // drop the impulses collected by the comparison
+            auto &state = world.state;
+            for (auto array : {&state.dvx, &state.dvy, &state.dvz, &state.dwx, &state.dwy, &state.dwz})
+                std::fill(array->begin(), array->end(), 0.0f);
+        }
+    }
+}
+
+// cloth vertices inside each bunny's box: every vertex against every body
+// against a spatial hash rebuilt each step and queried with the world bounds
+void benchClothContact()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    // the default cloth: 81 x 81 vertices over 9 x 9 units at scale 0.9
+    int n = 81;
+    std::vector<Vec3f> cloth(n * n);
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++)
+            cloth[j * n + i] = Vec3f(4.5f - 9.0f * i / (n - 1), 1.0f + 0.3f * sinf(i * 0.2f), 4.5f - 9.0f * j / (n - 1));
+
+    const int runs = 20;
+    for (int num : {10, 100, 1000})
+    {
+        std::mt19937 rng(num);
+        std::uniform_real_distribution<float> pos(-14, 14), height(-1, 4);
+        std::vector<std::shared_ptr<RigidObject>> bunnys;
+        for (int i = 0; i < num; i++)
+        {
+            auto bunny = std::make_shared<RigidObject>(asset);
+            bunny->scale = Vec3f(0.005);
+            bunny->computeAABBAndOctree();
+            bunny->nav.pos(pos(rng), height(rng), pos(rng));
+            bunnys.push_back(bunny);
+        }
+
+        size_t bruteHits = 0;
+        Timer brute;
+        for (int run = 0; run < runs; run++)
+        {
+            bruteHits = 0;
+            for (auto &bunny : bunnys)
+            {
+                Mat4f R;
+                Mat4f S = ScaleMatrix(bunny->scale);
+                bunny->nav.quat().toMatrix(R.elems());
+                auto inverseR = (S * R).inversed();
+                Vec3f x = bunny->nav.pos();
+                for (auto &vert : cloth)
+                {
+                    if (inBox(Vec3f(inverseR * Vec4f(vert - x, 1.0f)), bunny->AABBmin, bunny->AABBmax))
+                        bruteHits++;
+                }
+            }
+        }
+        double bruteMs = brute.ms() / runs;
+
+        SpatialHash hash;
+        size_t hashHits = 0, candidates = 0;
+        double buildMs = 0;
+        Timer hashed;
+        for (int run = 0; run < runs; run++)
+        {
+            Timer build;
+            hash.build(cloth, 0.5f);
+            buildMs += build.ms();
+            hashHits = candidates = 0;
+            for (auto &bunny : bunnys)
+            {
+                Mat4f R;
+                Mat4f S = ScaleMatrix(bunny->scale);
+                bunny->nav.quat().toMatrix(R.elems());
+                auto inverseR = (S * R).inversed();
+                Vec3f x = bunny->nav.pos();
+                Vec3f min, max;
+                bunny->worldAABB(min, max);
+                hash.query(min, max, [&](uint32_t i) {
+                    candidates++;
+                    if (inBox(Vec3f(inverseR * Vec4f(cloth[i] - x, 1.0f)), bunny->AABBmin, bunny->AABBmax))
+                        hashHits++;
+                });
+            }
+        }
+        double hashMs = hashed.ms() / runs;
+        std::cout << num << " bodies x " << cloth.size() << " cloth vertices: all " << bruteMs << " ms, "
+                  << bruteHits << " inside | hash " << hashMs << " ms (build " << buildMs / runs << " ms), "
+                  << hashHits << " inside of " << candidates << " candidates" << std::endl;
+    }
+}
+
+// scene tree upkeep for falling bunnies, and picking rays through it
+// against testing every body
+void benchSceneTree()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    const int steps = 60, rays = 1000;
+    for (int num : {1000, 10000})
+    {
+        std::mt19937 rng(num);
+        std::uniform_real_distribution<float> pos(-100, 100), height(0, 50), dir(-1, 1);
+        std::vector<std::shared_ptr<RigidObject>> bunnys;
+        std::vector<Vec3f> velocities;
+        AABBTree tree;
+        std::vector<int> proxies;
+        for (int i = 0; i < num; i++)
+        {
+            auto bunny = std::make_shared<RigidObject>(asset);
+            bunny->scale = Vec3f(0.005);
+            bunny->computeAABBAndOctree();
+            bunny->nav.pos(pos(rng), height(rng), pos(rng));
+            velocities.push_back(Vec3f(dir(rng), dir(rng), dir(rng)));
+            Vec3f min, max;
+            bunny->worldAABB(min, max);
+            proxies.push_back(tree.createProxy(min, max, bunny.get(), i));
+            bunnys.push_back(bunny);
+        }
+
+        double updateMs = 0;
+        int reinserted = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            for (int i = 0; i < num; i++)
+                bunnys[i]->nav.pos() += velocities[i] * 0.016f;
+            Timer t;
+            for (int i = 0; i < num; i++)
+            {
+                Vec3f min, max;
+                bunnys[i]->worldAABB(min, max);
+                reinserted += tree.moveProxy(proxies[i], min, max, velocities[i] * 0.016f);
+            }
+            updateMs += t.ms();
+        }
+
+        std::vector<Vec3f> origins, dirs;
+        for (int i = 0; i < rays; i++)
+        {
+            origins.push_back(Vec3f(pos(rng), height(rng), pos(rng)));
+            dirs.push_back(Vec3f(dir(rng), dir(rng), dir(rng)).normalize());
+        }
+        auto hitBox = [](Vec3f origin, Vec3f dir, Vec3f min, Vec3f max) {
+            float tMin = 0, tMax = 9999;
+            for (int k = 0; k < 3; k++)
+            {
+                float t0 = (min[k] - origin[k]) / dir[k], t1 = (max[k] - origin[k]) / dir[k];
+                tMin = std::max(tMin, std::min(t0, t1));
+                tMax = std::min(tMax, std::max(t0, t1));
+            }
+            return tMin <= tMax ? tMin : 9999.0f;
+        };
+        int linearHits = 0, treeHits = 0;
+        Timer linear;
+        for (int r = 0; r < rays; r++)
+        {
+            float nearT = 9999;
+            for (auto &bunny : bunnys)
+            {
+                Vec3f min, max;
+                bunny->worldAABB(min, max);
+                nearT = std::min(nearT, hitBox(origins[r], dirs[r], min, max));
+            }
+            linearHits += nearT < 9999;
+        }
+        double linearMs = linear.ms() / rays;
+        Timer picked;
+        for (int r = 0; r < rays; r++)
+        {
+            float nearT = 9999;
+            tree.rayCast(origins[r], dirs[r], nearT, [&](int proxy, float) {
+                Vec3f min, max;
+                bunnys[tree.tag(proxy)]->worldAABB(min, max);
+                nearT = std::min(nearT, hitBox(origins[r], dirs[r], min, max));
+                return nearT;
+            });
+            treeHits += nearT < 9999;
+        }
+        double treeMs = picked.ms() / rays;
+        std::cout << num << " bodies: tree height " << tree.height() << ", update " << updateMs / steps
+                  << " ms/step (" << reinserted / steps << " reinserted) | pick ray: all bodies " << linearMs * 1000
+                  << " us, tree " << treeMs * 1000 << " us, " << treeHits << "/" << linearHits << " hits" << std::endl;
+    }
+}
+
+// a layer of bunnies settling on the floor, with and without islands going
+// to sleep (taller piles keep sinking into each other and never rest yet)
+void benchSleep()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    const int steps = 900, window = 150;
+    for (bool sleeping : {false, true})
+    {
+        PhysicsWorld world;
+        world.sleeping = sleeping;
+        createBunnyPile(world, asset, 100);
+        std::cout << (sleeping ? "sleeping on:" : "sleeping off:") << std::endl;
+        double ms = 0;
+        for (int step = 1; step <= steps; step++)
+        {
+            Timer t;
+            world.step(0.016f);
+            ms += t.ms();
+            if (step % window == 0)
+            {
+                std::cout << "  steps " << step - window << "-" << step << ": " << ms / window << " ms/step, "
+                          << world.awakeCount() << " awake, " << world.contacts.size() << " contacts" << std::endl;
+                ms = 0;
+            }
+        }
+        if (sleeping)
+        {
+            Timer rest;
+            for (int step = 0; step < window; step++)
+                world.step(0.016f);
+            std::cout << "  then: " << rest.ms() / window << " ms/step, " << world.awakeCount() << " awake"
+                      << std::endl;
+            // a kick wakes the island of the kicked bunny
+            world.bodies[0]->addVelocity();
+            world.step(0.016f);
+            std::cout << "  after a kick: " << world.awakeCount() << " awake" << std::endl;
+        }
+    }
+}
+
+// the SoA integration kernels alone (no contacts) for 10k bodies, SIMD
+// batches against the scalar loops; both must end in the same state
+void benchIntegrate()
+{
+#if defined(__AVX__)
+    const char *simd = "AVX";
+#elif defined(SIMD_WIDTH)
+    const char *simd = "SSE2";
+#else
+    const char *simd = "none";
+#endif
+    const int num = 10000, steps = 1000;
+    RigidBodies results[2];
+    double ms[2];
+    for (int vectorized = 0; vectorized < 2; vectorized++)
+    {
+        auto &state = results[vectorized];
+        state.vectorized = vectorized;
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> u(-1, 1);
+        for (int i = 0; i < num; i++)
+        {
+            int id = state.add(Vec3f(u(rng), u(rng), u(rng)) * 10, Quatf(1, 0, 0, 0));
+            state.velocity(id, Vec3f(u(rng), u(rng), u(rng)));
+            state.wx[id] = u(rng);
+            state.wy[id] = u(rng);
+            state.wz[id] = u(rng);
+        }
+        Timer t;
+        for (int step = 0; step < steps; step++)
+        {
+            state.integrateVelocities(0.016f);
+            state.integratePositions(0.016f);
+            state.updateSleepTime(0.016f);
+        }
+        ms[vectorized] = t.ms() / steps;
+    }
+    float diff = 0;
+    for (int i = 0; i < num; i++)
+    {
+        diff = std::max(diff, (results[0].position(i) - results[1].position(i)).mag());
+        diff = std::max(diff, std::abs(results[0].qw[i] - results[1].qw[i]));
+    }
+    std::cout << num << " bodies: scalar " << ms[0] << " ms/step, " << simd << " " << ms[1] << " ms/step ("
+              << num / ms[1] / 1000 << " M bodies/s), max difference " << diff << std::endl;
+}
+
+// per point Mat4f * Vec4f against the scalar and SIMD batch kernels
+void benchKernels()
+{
+    Mat4f M;
+    Quatf(0.9f, 0.3f, -0.2f, 0.1f).normalize().toMatrix(M.elems());
+    M(0, 3) = 0.3f;
+    M(1, 3) = -0.2f;
+    M(2, 3) = 0.1f;
+    Vec3f min(-0.5f), max(0.5f), P(0, 0.2f, 0), N(0, 1, 0);
+    for (int num : {219, 6561, 100000})
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> u(-1, 1);
+        std::vector<Vec3f> points(num);
+        for (auto &p : points)
+            p = Vec3f(u(rng), u(rng), u(rng));
+        PointBuffer buffer, out;
+        buffer.assign(points);
+        std::vector<float> distances;
+        std::vector<uint32_t> inside;
+        const int reps = std::max(1, 2000000 / num);
+
+        int count[3] = {0, 0, 0};
+        float planeSum[3] = {0, 0, 0};
+        double ms[3];
+        Timer t;
+        for (int r = 0; r < reps; r++)
+        {
+            count[0] = 0;
+            planeSum[0] = 0;
+            for (auto &p : points)
+            {
+                Vec3f q = M * Vec4f(p, 1.0f);
+                if (q.dot(N) - P.dot(N) < 0)
+                    planeSum[0] += 1;
+                if (min.x < q.x && q.x < max.x && min.y < q.y && q.y < max.y && min.z < q.z && q.z < max.z)
+                    count[0]++;
+            }
+        }
+        ms[0] = t.ms() / reps;
+
+        t = Timer();
+        for (int r = 0; r < reps; r++)
+        {
+            transformPointsScalar(M, buffer, out);
+            planeDistancesScalar(out, P, N, distances);
+            count[1] = pointsInBoxScalar(M, buffer, min, max, inside);
+        }
+        ms[1] = t.ms() / reps;
+        for (float d : distances)
+            planeSum[1] += d < 0;
+
+        t = Timer();
+        for (int r = 0; r < reps; r++)
+        {
+            transformPoints(M, buffer, out);
+            planeDistances(out, P, N, distances);
+            count[2] = pointsInBox(M, buffer, min, max, inside);
+        }
+        ms[2] = t.ms() / reps;
+        for (float d : distances)
+            planeSum[2] += d < 0;
+
+        std::cout << num << " points: per point " << ms[0] * 1000 << " us, batch scalar " << ms[1] * 1000
+                  << " us, batch SIMD " << ms[2] * 1000 << " us (" << ms[0] / ms[2] << "x), inside "
+                  << count[0] << "/" << count[1] << "/" << count[2] << ", below plane " << planeSum[0] << "/"
+                  << planeSum[1] << "/" << planeSum[2] << std::endl;
+    }
+}
+
+// the room (and then 100 more boxes) as a pass per plane over a cloth's
+// local vertices, as the cloth used to, against one fused pass
+void benchStatic()
+{
+    int n = 81;
+    std::vector<Vec3f> local(n * n);
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++)
+            local[j * n + i] = Vec3f(5 - 10.0f * i / (n - 1), 0.3f * sinf(i * 0.2f), 5 - 10.0f * j / (n - 1));
+    Mat4f R;
+    Quatf(0.98f, 0.1f, 0, 0.05f).normalize().toMatrix(R.elems());
+    R = ScaleMatrix(Vec3f(0.9f)) * R;
+    Vec3f x(3, -1.3f, 11);
+    std::vector<Vec3f> world(local.size());
+    for (int i = 0; i < local.size(); i++)
+        world[i] = Vec3f(R * Vec4f(local[i], 1.0f)) + x;
+
+    StaticColliderSet colliders;
+    addRoom(colliders);
+    std::vector<Vec3f> planeP = {Vec3f(0, -1.5f, 0), Vec3f(15.0f, 0, 0), Vec3f(-15.0f, 0, 0), Vec3f(0, 0, 15.0f),
+                                 Vec3f(0, 0, -15.0f)};
+    const int runs = 200;
+    for (int boxes : {0, 100})
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> u(-14, 14);
+        for (int b = 0; b < boxes; b++)
+        {
+            Vec3f c(u(rng), -1, u(rng));
+            colliders.addBox(c - Vec3f(0.5f), c + Vec3f(0.5f));
+        }
+
+        size_t perPlane = 0;
+        Timer passes;
+        for (int run = 0; run < runs; run++)
+        {
+            perPlane = 0;
+            for (int c = 0; c < colliders.planeN.size(); c++)
+            {
+                for (auto &vert : local)
+                {
+                    Vec3f Rri = R * Vec4f(vert, 1.0f);
+                    if ((x + Rri - planeP[c]).dot(colliders.planeN[c]) < 0)
+                        perPlane++;
+                }
+            }
+            for (int c = 0; c < colliders.boxMin.size(); c++)
+            {
+                for (auto &vert : local)
+                {
+                    Vec3f p = Vec3f(R * Vec4f(vert, 1.0f)) + x;
+                    if (inBox(p, colliders.boxMin[c], colliders.boxMax[c]))
+                        perPlane++;
+                }
+            }
+        }
+        double passesMs = passes.ms() / runs;
+
+        PointBuffer points;
+        std::vector<uint32_t> hit;
+        size_t fused = 0;
+        Timer fusedTimer;
+        for (int run = 0; run < runs; run++)
+        {
+            points.assign(world);
+            colliders.hits(points, hit);
+            fused = 0;
+            for (auto i : hit)
+            {
+                colliders.contacts(world[i], [&](int, float) { fused++; });
+            }
+        }
+        double fusedMs = fusedTimer.ms() / runs;
+        std::cout << colliders.planeN.size() << " planes, " << colliders.boxMin.size() << " boxes x " << world.size()
+                  << " points: pass per collider " << passesMs << " ms, " << perPlane << " inside | fused "
+                  << fusedMs << " ms, " << fused << " inside (" << hit.size() << " points hit)" << std::endl;
+    }
+}
+
+// narrowphase of a 1000 bunny pile on pools of different sizes; the states
+// after the same steps must match bit for bit
+void benchParallelNarrowphase()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    const int steps = 60;
+    std::vector<int> threadNums = {1, 2, 4, (int)std::thread::hardware_concurrency()};
+    std::vector<std::vector<float>> states;
+    for (int threads : threadNums)
+    {
+        ThreadPool pool(threads);
+        PhysicsWorld world;
+        world.pool = &pool;
+        createBunnyPile(world, asset, 1000);
+        double narrowMs = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            world.updateBroadphase();
+            Timer narrow;
+            world.narrowphase();
+            narrowMs += narrow.ms();
+            world.buildIslands();
+            world.integrate(0.016f);
+            world.updateSleep();
+        }
+        auto &state = world.state;
+        std::vector<float> all;
+        for (auto array : {&state.px, &state.py, &state.pz, &state.qw, &state.qx, &state.qy, &state.qz, &state.vx,
+                           &state.vy, &state.vz, &state.wx, &state.wy, &state.wz})
+            all.insert(all.end(), array->begin(), array->end());
+        bool same = states.empty() || memcmp(all.data(), states[0].data(), all.size() * sizeof(float)) == 0;
+        states.push_back(all);
+        std::cout << threads << " threads: narrowphase " << narrowMs / steps << " ms/step, "
+                  << (same ? "identical to 1 thread" : "DIFFERS from 1 thread") << std::endl;
+    }
+}
+
+// 10 s of a 100 bunny pile drawn at different frame rates: physics runs the
+// same number of steps per second whatever the frame rate, and a 0.5 s stall
+// costs maxSteps steps instead of a burst of 31
+void benchTimestep()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    for (double fps : {30.0, 60.0, 144.0})
+    {
+        PhysicsWorld world;
+        createBunnyPile(world, asset, 100);
+        FixedTimestep timestep;
+        int frames = 10 * fps, steps = 0, maxPerFrame = 0;
+        double simulated = 0, physicsMs = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            double frameDt = frame == frames / 2 ? 0.5 : 1 / fps;
+            int n = timestep.advance(frameDt);
+            Timer t;
+            for (int i = 0; i < n; i++)
+                world.step(timestep.step);
+            physicsMs += t.ms();
+            steps += n;
+            maxPerFrame = std::max(maxPerFrame, n);
+            simulated += n * timestep.step;
+        }
+        std::cout << fps << " fps: " << steps << " steps, " << simulated << " s simulated of 10.5, at most "
+                  << maxPerFrame << " per frame, " << timestep.droppedFrames << " frames capped, physics "
+                  << physicsMs / 10.5 << " ms per second" << std::endl;
+    }
+}
+
+// a 1000 bunny pile on the physics thread while this thread "draws" at
+// 60 fps: what a frame pays is reading the newest snapshot, not the step
+void benchPhysicsThread()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    PhysicsWorld world;
+    createBunnyPile(world, asset, 1000);
+    PhysicsThread physics;
+    double stepMs = 0;
+    int steps = 0;
+    physics.step = [&](float dt) {
+        Timer t;
+        world.step(dt);
+        stepMs += t.ms();
+        steps++;
+    };
+    physics.publish = [&](PhysicsSnapshot &s) {
+        s.lastPos = world.lastPos;
+        s.lastQuat = world.lastQuat;
+        s.pos.resize(world.bodies.size());
+        s.quat.resize(world.bodies.size());
+        for (int i = 0; i < world.bodies.size(); i++)
+        {
+            s.pos[i] = world.state.position(i);
+            s.quat[i] = world.state.orientation(i);
+        }
+    };
+    physics.start();
+
+    const int frames = 120;
+    double frameMs = 0, worstMs = 0;
+    std::vector<Pose> drawPoses;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        Timer t;
+        auto &snapshot = physics.latest();
+        float alpha = snapshot.alpha(PhysicsThread::now());
+        drawPoses.resize(snapshot.bodies());
+        for (int i = 0; i < drawPoses.size(); i++)
+            drawPoses[i] = snapshot.pose(i, alpha);
+        double ms = t.ms();
+        frameMs += ms;
+        worstMs = std::max(worstMs, ms);
+        std::this_thread::sleep_for(std::chrono::microseconds(16667));
+    }
+    physics.stop();
+    std::cout << frames << " frames: snapshot read and blend " << frameMs / frames << " ms avg, " << worstMs
+              << " ms worst | physics thread: " << steps << " steps of " << stepMs / std::max(steps, 1)
+              << " ms, " << physics.timestep.droppedFrames << " capped" << std::endl;
+}
+
+// three layers of 100 bunnies stacked in columns, sleeping off so jitter
+// shows: the averaged impulse against the PGS solver at a few iteration
+// counts, cold and warm started, at 60 and 30 steps per second. Over the
+// last two of 10 seconds, when a stable pile has come to rest: iterations
+// the solver ran, mean and top body speed, and where the top layer rests
+void benchSolver()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    struct Config
+    {
+        const char *name;
+        bool useSolver;
+        int iterations;
+        bool warmStarting;
+    };
+    std::vector<Config> configs = {
+        {"averaged impulse", false, 0, false},
+        {"pgs 10 cold", true, 10, false},
+        {"pgs 4 warm", true, 4, true},
+        {"pgs 10 warm", true, 10, true},
+        {"pgs 50 warm", true, 50, true},
+    };
+    for (float dt : {1 / 60.0f, 1 / 30.0f})
+    {
+        std::cout << "dt " << dt << ":" << std::endl;
+        for (auto &config : configs)
+        {
+            PhysicsWorld world;
+            world.sleeping = false;
+            world.useSolver = config.useSolver;
+            world.solver.iterations = config.iterations;
+            world.solver.warmStarting = config.warmStarting;
+            createBunnyPile(world, asset, 300);
+            int steps = 10 / dt, window = 2 / dt;
+            double ms = 0, speed = 0;
+            float fastest = 0;
+            for (int step = 0; step < steps; step++)
+            {
+                if (step == steps - window)
+                {
+                    world.solver.totalIterations = world.solver.solves = 0;
+                    ms = 0;
+                }
+                Timer t;
+                world.step(dt);
+                ms += t.ms();
+                if (step >= steps - window)
+                {
+                    for (int i = 0; i < world.bodies.size(); i++)
+                    {
+                        float v = world.state.velocity(i).mag();
+                        fastest = std::max(fastest, v);
+                        speed += v / world.bodies.size() / window;
+                    }
+                }
+            }
+            float top = 0;
+            for (int i = 200; i < 300; i++)
+                top += world.state.py[i] / 100;
+            std::cout << "  " << config.name << ": " << ms / window << " ms/step";
+            if (config.useSolver)
+                std::cout << ", " << world.solver.averageIterations() << " iterations";
+            std::cout << ", mean speed " << speed << " m/s, fastest " << fastest << " m/s, top layer at y " << top
+                      << std::endl;
+        }
+    }
+}
+
+// a bunny shot at a 0.2 thick static wall and at a resting bunny, without
+// gravity, at speeds and steps where discrete contacts let it through; then
+// what continuous collision costs a 1000 bunny pile with no fast body
+void benchCCD()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    auto addBunny = [&](PhysicsWorld &world, float x) {
+        auto bunny = std::make_shared<RigidObject>(asset);
+        bunny->scale = Vec3f(0.005);
+        bunny->computeAABBAndOctree();
+        bunny->nav.pos(x, 0, 0);
+        bunny->nav.quat().fromAxisAngle(-0.5 * M_2PI, 1, 0, 0);
+        world.addBody(bunny);
+        world.state.g.back() = 0;
+    };
+    for (float dt : {1 / 60.0f, 1 / 30.0f})
+    {
+        for (float speed : {20.0f, 100.0f, 400.0f})
+        {
+            std::cout << "dt " << dt << ", " << speed << " m/s:";
+            for (bool continuous : {false, true})
+            {
+                PhysicsWorld wall;
+                wall.continuous = continuous;
+                wall.colliders.addBox(Vec3f(5, -5, -5), Vec3f(5.2f, 5, 5));
+                addBunny(wall, 0);
+                wall.state.vx[0] = speed;
+
+                PhysicsWorld pair;
+                pair.continuous = continuous;
+                addBunny(pair, 0);
+                addBunny(pair, 8);
+                pair.state.vx[0] = speed;
+
+                int swept = 0;
+                for (int step = 0; step < 1 / dt; step++)
+                {
+                    wall.step(dt);
+                    pair.step(dt);
+                    swept += wall.sweptBodies + pair.sweptBodies;
+                }
+                // through the wall, or past the other bunny without moving it
+                bool wallHeld = wall.state.px[0] < 5;
+                bool pairHit = pair.state.vx[1] > 0.1f * speed;
+                std::cout << (continuous ? " | continuous: " : " discrete: ") << "wall "
+                          << (wallHeld ? "held" : "tunnelled") << ", bunny " << (pairHit ? "hit" : "tunnelled");
+                if (continuous)
+                    std::cout << ", " << swept << " sweeps";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    const int steps = 60;
+    for (bool continuous : {false, true})
+    {
+        PhysicsWorld world;
+        world.continuous = continuous;
+        createBunnyPile(world, asset, 1000);
+        Timer t;
+        int swept = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            world.step(0.016f);
+            swept += world.sweptBodies;
+        }
+        std::cout << "1000 bunny pile, " << (continuous ? "continuous: " : "discrete: ") << t.ms() / steps
+                  << " ms/step, " << swept << " sweeps" << std::endl;
+    }
+}
+
+// quickhull and the contact proxy of the bunny. For octree depths 4 to 6, a
+// settled layer of 100 bunnies against the floor with static contacts from
+// every leaf center and from the 64 point proxy: cost per body of the static
+// pass and of a step, and how far the proxy moves the inertia. Then a stack
+// of convex boxes through GJK/EPA against the same boxes through octrees
+void benchHull()
+{
+    auto asset = std::make_shared<ObjectAsset>();
+    loadMesh(asset->mesh, "./assets/bunny/bunny.obj");
+    Timer hullTime;
+    ConvexHull hull;
+    quickhull(asset->mesh.vertices(), hull);
+    double hullMs = hullTime.ms();
+    std::cout << "bunny: " << asset->mesh.vertices().size() << " vertices, hull " << hull.vertices.size()
+              << " vertices " << hull.faces.size() << " faces in " << hullMs << " ms" << std::endl;
+
+    const int settle = 200, steps = 100;
+    for (int depth = 4; depth <= 6; depth++)
+    {
+        for (bool leaves : {true, false})
+        {
+            auto rigid = std::make_shared<RigidAsset>();
+            rigid->octreeDepth = depth;
+            rigid->computeAABBAndOctree(asset->mesh);
+            Mat4f proxyMoment = rigid->secondMoment;
+            if (leaves)
+            {
+                rigid->proxy = rigid->points;
+                rigid->proxyWeight.assign(rigid->points.size(), 1);
+                rigid->computeSecondMoment();
+            }
+            PhysicsWorld world;
+            world.sleeping = false;
+            addRoom(world.colliders);
+            for (int i = 0; i < 100; i++)
+            {
+                auto bunny = std::make_shared<RigidObject>(asset, rigid);
+                bunny->scale = Vec3f(0.005);
+                bunny->nav.pos(-12.15f + 2.7f * (i % 10), 0, -12.15f + 2.7f * (i / 10));
+                bunny->nav.quat().fromAxisAngle(-0.5 * M_2PI, 1, 0, 0);
+                world.addBody(bunny);
+            }
+            for (int step = 0; step < settle; step++)
+                world.step(0.016f);
+
+            std::vector<ContactManifold> manifolds;
+            Timer staticTime;
+            for (int step = 0; step < steps; step++)
+            {
+                manifolds.clear();
+                for (auto &body : world.bodies)
+                    body->staticManifolds(world.colliders, manifolds);
+            }
+            double staticUs = staticTime.ms() * 1000 / steps / world.bodies.size();
+            Timer stepTime;
+            for (int step = 0; step < steps; step++)
+                world.step(0.016f);
+
+            std::cout << "depth " << depth << ", " << (leaves ? "every leaf: " : "proxy:      ") << rigid->proxy.size()
+                      << " points, static " << staticUs << " us/body, step " << stepTime.ms() / steps << " ms";
+            if (leaves)
+            {
+                float error = 0, norm = 0;
+                for (int i = 0; i < 3; i++)
+                {
+                    for (int j = 0; j < 3; j++)
+                    {
+                        float d = proxyMoment(i, j) - rigid->secondMoment(i, j);
+                        error += d * d;
+                        norm += rigid->secondMoment(i, j) * rigid->secondMoment(i, j);
+                    }
+                }
+                std::cout << ", proxy inertia off by " << sqrtf(error / norm) * 100 << "%";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // a 2 x 2 x 2 box with 9 x 9 vertices on each face
+    auto box = std::make_shared<ObjectAsset>();
+    for (int face = 0; face < 6; face++)
+    {
+        for (int u = 0; u <= 8; u++)
+        {
+            for (int v = 0; v <= 8; v++)
+            {
+                Vec3f p;
+                p[face / 2] = face % 2 ? 1 : -1;
+                p[(face / 2 + 1) % 3] = u / 4.0f - 1;
+                p[(face / 2 + 2) % 3] = v / 4.0f - 1;
+                box->mesh.vertex(p);
+            }
+        }
+    }
+    for (bool convex : {true, false})
+    {
+        auto rigid = std::make_shared<RigidAsset>();
+        rigid->computeAABBAndOctree(box->mesh);
+        bool isConvex = rigid->convex;
+        rigid->convex = convex;
+        PhysicsWorld world;
+        world.sleeping = false;
+        addRoom(world.colliders);
+        const int height = 5;
+        for (int i = 0; i < height; i++)
+        {
+            auto body = std::make_shared<RigidObject>(box, rigid);
+            body->scale = Vec3f(1);
+            body->nav.pos(0.05f * (i % 2), -0.5f + 2.05f * i, 0);
+            world.addBody(body);
+        }
+        double pairUs = 0;
+        int pairs = 0;
+        float fastest = 0;
+        for (int step = 0; step < 300; step++)
+        {
+            world.step(0.016f);
+            if (step < 200)
+                continue;
+            for (int i = 0; i < height; i++)
+                fastest = std::max(fastest, world.state.velocity(i).mag());
+            std::vector<std::pair<uint32_t, uint32_t>> leafPairs;
+            OctreePairScratch octreePairs;
+            std::vector<ContactPoint> candidates;
+            ContactManifold manifold;
+            Timer t;
+            for (auto &pair : world.pairs)
+                world.bodies[pair.first]->contactManifold(*world.bodies[pair.second], leafPairs, octreePairs,
+                                                          candidates, manifold);
+            pairUs += t.ms() * 1000;
+            pairs += world.pairs.size();
+        }
+        std::cout << height << " boxes (" << (isConvex ? "convex" : "not convex") << "), "
+                  << (convex ? "GJK/EPA: " : "octree:  ") << pairUs / pairs << " us/pair, top at y "
+                  << world.state.py[height - 1] << " (" << -1.5f + 2 * height - 1 << " exact), fastest "
+                  << fastest << " m/s in the last 100 steps" << std::endl;
+    }
+}
+
+// the bunny's distance field by resolution: build time, memory against a
+// dense grid, the cost of a sample and its error against the exact distance
+// to the triangles at points on the surface. Then how far the sphere the
+// cloth used to stand in for a bunny is from the bunny's surface
+void benchSDF()
+{
+    Mesh mesh;
+    loadMesh(mesh, "./assets/bunny/bunny.obj");
+    auto &vertices = mesh.vertices();
+    auto &indices = mesh.indices();
+    Vec3f min, max;
+    meshBounds(mesh, min, max);
+    auto exact = [&](const Vec3f &p) {
+        float d = 1e30f;
+        for (int t = 0; t < indices.size(); t += 3)
+        {
+            Vec3f q = closestPointOnTriangle(p, vertices[indices[t]], vertices[indices[t + 1]], vertices[indices[t + 2]]);
+            d = std::min(d, (p - q).mag());
+        }
+        return d;
+    };
+
+    // points within 1% of the size of the bunny from its surface, where
+    // contacts are; the errors are of those inside each grid
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, vertices.size() - 1);
+    std::uniform_real_distribution<float> offset(-1, 1);
+    float size = (max - min).mag();
+    std::vector<Vec3f> near(1000);
+    std::vector<float> truth(near.size());
+    for (int i = 0; i < near.size(); i++)
+    {
+        near[i] = vertices[pick(rng)] + Vec3f(offset(rng), offset(rng), offset(rng)) * 0.01f * size;
+        truth[i] = exact(near[i]);
+    }
+
+    SignedDistanceField finest;
+    finest.resolution = 256;
+    finest.build(vertices, indices);
+    for (int resolution : {16, 32, 64, 128, 256})
+    {
+        SignedDistanceField sdf;
+        sdf.resolution = resolution;
+        Timer build;
+        sdf.build(vertices, indices);
+        double buildMs = build.ms();
+        int fine = 0;
+        for (int b : sdf.brickIndex)
+            fine += b >= 0;
+        size_t dense = sizeof(float) * (sdf.bricks[0] * sdf.brickSize + 1) * (sdf.bricks[1] * sdf.brickSize + 1) *
+                       (sdf.bricks[2] * sdf.brickSize + 1);
+
+        float error = 0, worst = 0;
+        int flipped = 0, inGrid = 0;
+        for (int i = 0; i < near.size(); i++)
+        {
+            Vec3f g = (near[i] - sdf.origin) / (sdf.cell * sdf.brickSize);
+            if (g.x < 0 || g.y < 0 || g.z < 0 || g.x > sdf.bricks[0] || g.y > sdf.bricks[1] || g.z > sdf.bricks[2])
+                continue;
+            inGrid++;
+            Vec3f gradient, finestGradient;
+            float d = sdf.sample(near[i], gradient);
+            float e = fabsf(fabsf(d) - truth[i]);
+            error += e;
+            worst = std::max(worst, e);
+            // by the finest field, away from where its sign may be off by a cell
+            float reference = finest.sample(near[i], finestGradient);
+            flipped += fabsf(reference) > 2 * finest.cell && (d < 0) != (reference < 0);
+        }
+        std::vector<Vec3f> queries(100000);
+        for (auto &q : queries)
+            q = near[pick(rng) % near.size()] + Vec3f(offset(rng), offset(rng), offset(rng)) * 0.01f * size;
+        volatile float sum = 0; // keeps the samples
+        Timer query;
+        for (auto &q : queries)
+        {
+            Vec3f gradient;
+            sum += sdf.sample(q, gradient);
+        }
+        double queryNs = query.ms() * 1e6 / queries.size();
+        std::cout << "resolution " << resolution << ": built in " << buildMs << " ms, " << fine << " of "
+                  << sdf.brickIndex.size() << " bricks fine, " << sdf.memoryBytes() / 1024 << " KB (dense "
+                  << dense / 1024 << " KB), " << queryNs << " ns/sample, error mean " << error / inGrid / size * 100
+                  << "% max " << worst / size * 100 << "% of the bunny, " << flipped << " of " << near.size()
+                  << " signs off" << std::endl;
+    }
+
+    // the old stand-in: a sphere of radius |AABBAverageLength| at the origin
+    Vec3f average;
+    for (int k = 0; k < 3; k++)
+        average[k] = (fabsf(max[k]) + fabsf(min[k])) / 2;
+    float radius = average.mag();
+    float gap = 0, deepest = 0;
+    int count = 0, inside = 0;
+    for (int i = 0; i < 500; i++)
+    {
+        Vec3f dir = Vec3f(offset(rng), offset(rng), offset(rng));
+        if (dir.mag() > 1 || dir.mag() < 0.1f)
+            continue;
+        Vec3f p = dir.normalize() * radius;
+        Vec3f gradient;
+        float d = finest.sample(p, gradient);
+        if (d < 0)
+            deepest = std::min(deepest, d), inside++;
+        else
+            gap += d;
+        count++;
+    }
+    std::cout << "sphere stand-in: " << count - inside << " of " << count << " points on it float "
+              << gap / std::max(count - inside, 1) / size * 100 << "% of the bunny off its surface, " << inside
+              << " are " << -deepest / size * 100 << "% deep inside it" << std::endl;
+}
+
+// the cloth step as MassSpring::onAnimate used to take it, fresh vectors
+// every step and copies inside the iterations, on the springs and settings
+// of cloth and the velocities V
+void oldClothStep(const ClothSolver &cloth, std::vector<Vec3f> &X, std::vector<Vec3f> &V, double dt)
+{
+    float mass = cloth.mass, spring_k = cloth.spring_k, rho = cloth.rho;
+    auto computeGradient = [&](std::vector<Vec3f> &X, std::vector<Vec3f> &XHat, float t, std::vector<Vec3f> &G) {
+        for (int i = 0; i < G.size(); i++)
+        {
+            G[i] = (1 / t) * mass * (X[i] - XHat[i]) * (1 / t);
+            G[i] -= mass * cloth.g;
+        }
+        for (int e = 0; e < cloth.springs; e++)
+        {
+            int i = cloth.springA[e];
+            int j = cloth.springB[e];
+            Vec3f dir = X[i] - X[j];
+            G[i] += spring_k * (1 - cloth.L[e] / (dir).mag()) * (dir);
+            G[j] -= spring_k * (1 - cloth.L[e] / (dir).mag()) * (dir);
+        }
+    };
+    std::vector<Vec3f> last_X(X.size());
+    std::vector<Vec3f> XHat(X.size());
+    std::vector<Vec3f> G(X.size());
+    for (int i = 0; i < X.size(); i++)
+    {
+        V[i] *= cloth.damping;
+        XHat[i] = X[i] + V[i] * dt;
+        X[i] = XHat[i];
+        last_X[i] = Vec3f(0);
+        G[i] = Vec3f(0);
+    }
+    for (int k = 0; k < 32; k++)
+    {
+        float w = 0;
+        computeGradient(X, XHat, dt, G);
+        if (k == 0) w = 1;
+        else if (k == 1) w = 2 / (2 - rho * rho);
+        else w = 4 / (4 - rho * rho * w);
+        auto oldX = X;
+        for (int i = 0; i < X.size(); i++)
+        {
+            if (cloth.pinned[i]) continue;
+            X[i] -= G[i] / (float)((1 / dt) * mass * (1 / dt) + 4 * spring_k);
+            X[i] = w * X[i] + (1 - w) * last_X[i];
+        }
+        last_X = oldX;
+    }
+    for (int i = 0; i < X.size(); i++)
+    {
+        if (cloth.pinned[i]) continue;
+        V[i] += (X[i] - XHat[i]) * (1 / dt);
+    }
+}
+
+// the default cloth (81 x 81, pinned at two corners) falling for 300 steps
+// onto the room's floor: time and heap allocations per step of the old
+// step against ClothSolver, then the whole CPU side of MassSpring::onAnimate
+// (solver, static colliders, spatial hash), which must not allocate at all
+// once warmed up, also when the solver runs across a pool
+void benchClothStep()
+{
+    const int n = 81, steps = 300, warmup = 5;
+    const float dt = 0.016f;
+    std::vector<Vec3f> grid;
+    std::vector<Vec2f> UV;
+    std::vector<Mesh::Index> triangles;
+    clothGrid(n, 10, grid, UV, triangles);
+    for (auto &p : grid)
+        p = p * 0.9f + Vec3f(0, 8, 0);
+    auto start = [&](ClothSolver &cloth, std::vector<Vec3f> &X) {
+        X = grid;
+        cloth.setMesh(X, triangles);
+        cloth.pinned[0] = cloth.pinned[n - 1] = 1;
+    };
+
+    ClothSolver oldCloth, newCloth;
+    std::vector<Vec3f> oldX, newX;
+    start(oldCloth, oldX);
+    start(newCloth, newX);
+    newCloth.tolerance = 0; // every iteration, as the old step
+    std::vector<Vec3f> oldV(oldX.size(), Vec3f(0));
+    double oldMs = 0, newMs = 0;
+    long oldAllocations = 0, newAllocations = 0;
+    float drift = 0, earlyDrift = 0;
+    for (int step = 0; step < steps; step++)
+    {
+        long before = allocations;
+        Timer t;
+        oldClothStep(oldCloth, oldX, oldV, dt);
+        oldMs += t.ms();
+        oldAllocations += allocations - before;
+
+        before = allocations;
+        Timer u;
+        newCloth.step(newX, dt);
+        newMs += u.ms();
+        if (step >= warmup)
+            newAllocations += allocations - before;
+        for (int i = 0; i < newX.size(); i++)
+            drift = std::max(drift, (newX[i] - oldX[i]).mag());
+        if (step == 9)
+            earlyDrift = drift;
+    }
+    std::cout << "old step: " << oldMs / steps << " ms, " << (double)oldAllocations / steps << " allocations/step"
+              << std::endl;
+    std::cout << "ClothSolver: " << newMs / steps << " ms, " << (double)newAllocations / (steps - warmup)
+              << " allocations/step after " << warmup << ", farthest from the old step " << earlyDrift
+              << " after 10 steps, " << drift << " after " << steps << std::endl;
+
+    // collideStatic and the hash as MassSpring::onAnimate runs them
+    ThreadPool pool(4);
+    newCloth.pool = &pool;
+    StaticColliderSet colliders;
+    addRoom(colliders);
+    PointBuffer staticPoints;
+    std::vector<uint32_t> staticHits;
+    SpatialHash hash;
+    start(newCloth, newX);
+    long sceneAllocations = 0;
+    for (int step = 0; step < steps; step++)
+    {
+        long before = allocations;
+        newCloth.step(newX, dt);
+        staticPoints.assign(newX);
+        colliders.hits(staticPoints, staticHits);
+        for (auto i : staticHits)
+        {
+            colliders.contacts(newX[i], [&](int slot, float depth) {
+                Vec3f N = colliders.normal(slot);
+                Vec3f v = newCloth.V.get(i);
+                if (dot(v, N) < 0)
+                {
+                    newX[i] += (depth + Vec3f(0.01f)) * N;
+                    newCloth.V.set(i, v + depth * (1 / dt) * N);
+                }
+            });
+        }
+        hash.build(newX, 0.5f);
+        if (step >= warmup)
+            sceneAllocations += allocations - before;
+    }
+    std::cout << "with static colliders and the hash, 4 threads: " << sceneAllocations << " allocations in "
+              << steps - warmup << " steps after " << warmup << ", " << staticHits.size() << " vertices on the floor"
+              << std::endl;
+    if (newAllocations != 0 || sceneAllocations != 0)
+    {
+        std::cout << "FAILED: the cloth step allocates" << std::endl;
+        std::exit(1);
+    }
+}
+
+// cloths of 81 x 81 up to 1000 x 1000 vertices falling under gravity,
+// pinned at two corners, stepped across pools of 1 to 8 threads: time per
+// step against the 60 Hz budget, and whether the vertices match the
+// single thread bit for bit
+void benchClothParallel()
+{
+    const float dt = 1.0f / 60;
+    for (int n : {81, 500, 1000})
+    {
+        std::vector<Vec3f> grid;
+        std::vector<Vec2f> UV;
+        std::vector<Mesh::Index> triangles;
+        clothGrid(n, 10, grid, UV, triangles);
+        const int steps = n > 500 ? 3 : 10;
+        std::vector<Vec3f> serial;
+        for (int threads : {1, 2, 4, 8})
+        {
+            ThreadPool pool(threads);
+            ClothSolver cloth;
+            std::vector<Vec3f> X = grid;
+            cloth.setMesh(X, triangles);
+            cloth.pinned[0] = cloth.pinned[n - 1] = 1;
+            cloth.pool = &pool;
+            cloth.step(X, dt); // sizes the buffers
+            Timer t;
+            for (int step = 1; step < steps; step++)
+                cloth.step(X, dt);
+            double ms = t.ms() / (steps - 1);
+            if (threads == 1)
+                serial = X;
+            bool identical = memcmp(serial.data(), X.data(), X.size() * sizeof(Vec3f)) == 0;
+            std::cout << n << " x " << n << ", " << threads << " threads: " << ms << " ms/step ("
+                      << (ms < 1000.0 / 60 ? "real time" : "slower than real time") << "), "
+                      << (identical ? "identical to 1 thread" : "DIFFERS from 1 thread") << std::endl;
+        }
+    }
+    std::cout << "(" << std::thread::hardware_concurrency() << " hardware threads)" << std::endl;
+}
+
+// the spring forces of a 500 x 500 cloth in three layouts: vertices and
+// springs interleaved with two square roots per spring as computeGradient
+// had them, structure of arrays with the scalar kernel, and the same with
+// the SIMD kernel, whose error is measured against the scalar one
+void benchClothKernels()
+{
+    const int n = 500, repeats = 20;
+    std::vector<Vec3f> X;
+    std::vector<Vec2f> UV;
+    std::vector<Mesh::Index> triangles;
+    clothGrid(n, 10, X, UV, triangles);
+    ClothSolver cloth;
+    cloth.setMesh(X, triangles);
+    // stretched and crumpled, so no spring is at rest
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> jitter(-0.005f, 0.005f);
+    for (auto &p : X)
+        p = p * 1.1f + Vec3f(jitter(rng), jitter(rng), jitter(rng));
+    PointBuffer points, scalarF, simdF;
+    points.assign(X);
+    scalarF.resize(cloth.springA.size());
+    simdF.resize(cloth.springA.size());
+
+    std::vector<int> E;
+    for (int e = 0; e < cloth.springs; e++)
+    {
+        E.push_back(cloth.springA[e]);
+        E.push_back(cloth.springB[e]);
+    }
+    std::vector<Vec3f> G(X.size());
+    Timer aos;
+    for (int r = 0; r < repeats; r++)
+    {
+        std::fill(G.begin(), G.end(), Vec3f(0));
+        for (int e = 0; e < E.size() / 2; e++)
+        {
+            int i = E[e * 2 + 0];
+            int j = E[e * 2 + 1];
+            Vec3f dir = X[i] - X[j];
+            G[i] += cloth.spring_k * (1 - cloth.L[e] / (dir).mag()) * (dir);
+            G[j] -= cloth.spring_k * (1 - cloth.L[e] / (dir).mag()) * (dir);
+        }
+    }
+    double aosNs = aos.ms() * 1e6 / repeats / cloth.springs;
+    Timer scalar;
+    for (int r = 0; r < repeats; r++)
+        cloth.springForcesScalar(points, scalarF, 0, cloth.springA.size());
+    double scalarNs = scalar.ms() * 1e6 / repeats / cloth.springs;
+    Timer simd;
+    for (int r = 0; r < repeats; r++)
+        cloth.springForces(points, simdF, 0, cloth.springA.size());
+    double simdNs = simd.ms() * 1e6 / repeats / cloth.springs;
+
+    // relative to spring_k * length, the scale of the terms that cancel near rest
+    float error = 0;
+    for (int e = 0; e < cloth.springs; e++)
+    {
+        float length = (points.get(cloth.springA[e]) - points.get(cloth.springB[e])).mag();
+        error = std::max(error, (simdF.get(e) - scalarF.get(e)).mag() / (cloth.spring_k * length));
+    }
+#ifdef SIMD_WIDTH
+    int width = SIMD_WIDTH;
+#else
+    int width = 1;
+#endif
+    std::cout << cloth.springs << " springs: interleaved " << aosNs << " ns/spring, arrays " << scalarNs
+              << " ns/spring, SIMD (" << width << " lanes) " << simdNs << " ns/spring, largest relative error "
+              << error << std::endl;
+}
+
+// the 81 x 81 cloth of MassSpring hanging from two corners for 32 seconds,
+// its middle row struck downwards at 5 m/s after 19: iterations and time per
+// step over each phase with the residual tolerance, and how far that leaves
+// the cloth from running all 32 iterations, next to how far 32 are from 48
+void benchClothResidual()
+{
+    const int n = 81, steps = 2000, strike = 1200;
+    const float dt = 0.016f;
+    std::vector<Vec3f> grid;
+    std::vector<Vec2f> UV;
+    std::vector<Mesh::Index> triangles;
+    clothGrid(n, 10, grid, UV, triangles);
+    for (auto &p : grid)
+        p = p * 0.9f + Vec3f(0, 8, 0);
+
+    struct Run
+    {
+        ClothSolver cloth;
+        std::vector<Vec3f> X;
+    };
+    Run runs[3];
+    for (auto &run : runs)
+    {
+        run.X = grid;
+        run.cloth.setMesh(run.X, triangles);
+        run.cloth.pinned[0] = run.cloth.pinned[n - 1] = 1;
+    }
+    Run &adaptive = runs[0], &fixed = runs[1], &more = runs[2];
+    fixed.cloth.tolerance = more.cloth.tolerance = 0;
+    more.cloth.iterations = 48;
+
+    struct Phase
+    {
+        const char *name;
+        int end;
+    };
+    std::vector<Phase> phases = {{"falling", 600}, {"resting", strike}, {"struck", 1400}, {"resting again", steps}};
+    int phase = 0;
+    double adaptiveMs = 0, fixedMs = 0;
+    int phaseSteps = 0, peak = 0;
+    for (int step = 0; step < steps; step++)
+    {
+        if (step == strike)
+        {
+            for (auto &run : runs)
+            {
+                for (int i = n / 2 * n; i < (n / 2 + 1) * n; i++)
+                    run.cloth.V.set(i, Vec3f(0, -5, 0));
+            }
+        }
+        Timer t;
+        adaptive.cloth.step(adaptive.X, dt);
+        adaptiveMs += t.ms();
+        Timer u;
+        fixed.cloth.step(fixed.X, dt);
+        fixedMs += u.ms();
+        more.cloth.step(more.X, dt);
+        peak = std::max(peak, adaptive.cloth.lastIterations);
+        phaseSteps++;
+
+        if (step + 1 == phases[phase].end)
+        {
+            float fromFixed = 0, fixedFromMore = 0;
+            for (int i = 0; i < grid.size(); i++)
+            {
+                fromFixed = std::max(fromFixed, (adaptive.X[i] - fixed.X[i]).mag());
+                fixedFromMore = std::max(fixedFromMore, (fixed.X[i] - more.X[i]).mag());
+            }
+            std::cout << phases[phase].name << ": " << adaptive.cloth.averageIterations() << " iterations (at most "
+                      << peak << "), " << adaptiveMs / phaseSteps << " ms/step against " << fixedMs / phaseSteps
+                      << " for 32, residual " << adaptive.cloth.lastResidual << " m/s; " << fromFixed
+                      << " from 32 iterations, which are " << fixedFromMore << " from 48" << std::endl;
+            adaptive.cloth.totalIterations = adaptive.cloth.steps = 0;
+            adaptiveMs = fixedMs = 0;
+            phaseSteps = peak = 0;
+            phase++;
+        }
+    }
+}
+
+// one step of cloths of 41 x 41 up to 161 x 161 vertices, 0.8 s into their
+// fall, at the default and a ten times stiffer spring_k: Jacobi against
+// Projective Dynamics at a few iteration counts. The error is the energy the
+// step minimizes above its minimum (500 Projective Dynamics iterations), as
+// a fraction of where the iterations start from
+void benchClothProjective()
+{
+    const float dt = 0.016f;
+    for (int n : {41, 81, 161})
+    {
+        std::vector<Vec3f> grid;
+        std::vector<Vec2f> UV;
+        std::vector<Mesh::Index> triangles;
+        clothGrid(n, 10, grid, UV, triangles);
+        for (auto &p : grid)
+            p = p * 0.9f + Vec3f(0, 8, 0);
+        for (float k : {80000.0f, 800000.0f})
+        {
+            ClothSolver cloth;
+            std::vector<Vec3f> X = grid;
+            cloth.setMesh(X, triangles);
+            cloth.pinned[0] = cloth.pinned[n - 1] = 1;
+            cloth.spring_k = k;
+            cloth.tolerance = 0;
+            for (int step = 0; step < 50; step++)
+                cloth.step(X, dt);
+
+            // inertia, springs and gravity against the predicted positions
+            std::vector<Vec3f> predicted = X;
+            for (int i = 0; i < X.size(); i++)
+                predicted[i] += cloth.V.get(i) * cloth.damping * dt;
+            auto energy = [&](const std::vector<Vec3f> &Y) {
+                double e = 0;
+                for (int i = 0; i < Y.size(); i++)
+                    e += 0.5 * cloth.mass / (dt * dt) * (Y[i] - predicted[i]).magSqr() - cloth.mass * cloth.g.dot(Y[i]);
+                for (int s = 0; s < cloth.springs; s++)
+                {
+                    double stretch = (Y[cloth.springA[s]] - Y[cloth.springB[s]]).mag() - cloth.L[s];
+                    e += 0.5 * cloth.spring_k * stretch * stretch;
+                }
+                return e;
+            };
+
+            Timer t;
+            cloth.factorProjective(dt);
+            double factorMs = t.ms();
+            ClothSolver converged = cloth;
+            std::vector<Vec3f> reference = X;
+            converged.projective = true;
+            converged.projectiveIterations = 500;
+            converged.step(reference, dt);
+            double minimum = energy(reference), start = energy(predicted) - minimum;
+            std::cout << n << " x " << n << ", spring_k " << k << ": factored in " << factorMs << " ms" << std::endl;
+
+            auto run = [&](const char *name, bool projective, int iterations) {
+                ClothSolver copy = cloth;
+                std::vector<Vec3f> Y = X;
+                copy.projective = projective;
+                copy.iterations = copy.projectiveIterations = iterations;
+                Timer t;
+                copy.step(Y, dt);
+                double ms = t.ms();
+                std::cout << "  " << name << " " << iterations << ": " << ms << " ms, error "
+                          << (energy(Y) - minimum) / start << std::endl;
+            };
+            for (int iterations : {8, 32, 128})
+                run("jacobi", false, iterations);
+            for (int iterations : {2, 4, 8, 16})
+                run("projective", true, iterations);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::pair<std::string, std::function<void()>>> benches = {
+        {"octree", benchOctree},
+        {"deepOctree", benchDeepOctree},
+        {"batchOctree", benchBatchOctree},
+        {"narrowphase", benchNarrowphase},
+        {"spawn", benchSpawn},
+        {"broadphase", benchBroadphase},
+        {"clothContact", benchClothContact},
+        {"sceneTree", benchSceneTree},
+        {"sleep", benchSleep},
+        {"integrate", benchIntegrate},
+        {"kernels", benchKernels},
+        {"static", benchStatic},
+        {"parallelNarrowphase", benchParallelNarrowphase},
+        {"timestep", benchTimestep},
+        {"physicsThread", benchPhysicsThread},
+        {"solver", benchSolver},
+        {"ccd", benchCCD},
+        {"hull", benchHull},
+        {"sdf", benchSDF},
+        {"clothStep", benchClothStep},
+        {"clothParallel", benchClothParallel},
+        {"clothKernels", benchClothKernels},
+        {"clothResidual", benchClothResidual},
+        {"clothProjective", benchClothProjective},
+    };
+    for (auto &bench : benches)
+    {
+        bool run = argc < 2;
+        for (int i = 1; i < argc; i++)
+            run |= bench.first == argv[i];
+        if (run)
+        {
+            std::cout << "== " << bench.first << " ==" << std::endl;
+            bench.second();
+        }
+    }
+    return 0;
+}
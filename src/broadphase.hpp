@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "al/math/al_Vec.hpp"
+
+using namespace al;
+
+// Sweep and prune over world space bounds. The endpoint list along the sweep
+// axis is kept sorted from one step to the next, so the insertion sort only
+// pays for bodies that changed order since the last step.
+class SweepAndPrune
+{
+public:
+    int axis = 0; // sweep axis
+
+    int add(Vec3f min, Vec3f max)
+    {
+        int id = mins.size();
+        mins.push_back(min);
+        maxs.push_back(max);
+        endpoints.push_back({min[axis], (uint32_t)id << 1});
+        endpoints.push_back({max[axis], (uint32_t)id << 1 | 1});
+        activeIndex.push_back(-1);
+        return id;
+    }
+
+    void update(int id, Vec3f min, Vec3f max)
+    {
+        mins[id] = min;
+        maxs[id] = max;
+    }
+
+    int size() const { return mins.size(); }
+
+    void bounds(int id, Vec3f &min, Vec3f &max) const
+    {
+        min = mins[id];
+        max = maxs[id];
+    }
+
+    // overlapping pairs (i < j), each once
+    void findPairs(std::vector<std::pair<int, int>> &pairs)
+    {
+        pairs.clear();
+        for (auto &endpoint : endpoints)
+        {
+            int id = endpoint.data >> 1;
+            endpoint.value = (endpoint.data & 1) ? maxs[id][axis] : mins[id][axis];
+        }
+        // insertion sort, nearly linear on coherent frames
+        for (size_t i = 1; i < endpoints.size(); i++)
+        {
+            Endpoint endpoint = endpoints[i];
+            size_t j = i;
+            while (j > 0 && before(endpoint, endpoints[j - 1]))
+            {
+                endpoints[j] = endpoints[j - 1];
+                j--;
+            }
+            endpoints[j] = endpoint;
+        }
+
+        int other1 = (axis + 1) % 3;
+        int other2 = (axis + 2) % 3;
+        active.clear();
+        for (auto &endpoint : endpoints)
+        {
+            int id = endpoint.data >> 1;
+            if (endpoint.data & 1)
+            {
+                // swap remove from the active list
+                int index = activeIndex[id];
+                activeIndex[active.back()] = index;
+                active[index] = active.back();
+                active.pop_back();
+                activeIndex[id] = -1;
+                continue;
+            }
+            for (int other : active)
+            {
+                if (mins[id][other1] <= maxs[other][other1] && mins[other][other1] <= maxs[id][other1] &&
+                    mins[id][other2] <= maxs[other][other2] && mins[other][other2] <= maxs[id][other2])
+                {
+                    pairs.push_back(id < other ? std::make_pair(id, other) : std::make_pair(other, id));
+                }
+            }
+            activeIndex[id] = active.size();
+            active.push_back(id);
+        }
+    }
+
+private:
+    struct Endpoint
+    {
+        float value;
+        uint32_t data; // id << 1 | isMax
+    };
+
+    // mins sort before maxs at equal values, so touching bounds overlap
+    static bool before(const Endpoint &a, const Endpoint &b)
+    {
+        return a.value < b.value || (a.value == b.value && (a.data & 1) < (b.data & 1));
+    }
+
+    std::vector<Vec3f> mins, maxs;
+    std::vector<Endpoint> endpoints;
+    std::vector<int> active;
+    std::vector<int> activeIndex;
+};
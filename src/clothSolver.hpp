@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "al/graphics/al_Mesh.hpp"
+#include "al/math/al_Vec.hpp"
+#include "math_helper.hpp"
+#include "simd.hpp"
+#include "simdKernels.hpp"
+#include "skylineCholesky.hpp"
+#include "threadPool.hpp"
+
+using namespace al;
+
+// n x n vertices over size x size in the xz plane, two triangles per quad
+void clothGrid(int n, float size, std::vector<Vec3f> &X, std::vector<Vec2f> &UV,
+               std::vector<Mesh::Index> &triangles)
+{
+    X.resize(n * n);
+    UV.resize(n * n);
+    triangles.resize((n - 1) * (n - 1) * 6);
+    for (int j = 0; j < n; j++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            X[j * n + i] = Vec3f(size / 2 - size * i / (n - 1), 0, size / 2 - size * j / (n - 1));
+            UV[j * n + i] = Vec2f(i / (n - 1.0f), j / (n - 1.0f));
+        }
+    }
+    int t = 0;
+    for (int j = 0; j < n - 1; j++)
+    {
+        for (int i = 0; i < n - 1; i++)
+        {
+            triangles[t * 6 + 0] = j * n + i;
+            triangles[t * 6 + 1] = j * n + i + 1;
+            triangles[t * 6 + 2] = (j + 1) * n + i + 1;
+            triangles[t * 6 + 3] = j * n + i;
+            triangles[t * 6 + 4] = (j + 1) * n + i + 1;
+            triangles[t * 6 + 5] = (j + 1) * n + i;
+            t++;
+        }
+    }
+}
+
+// Implicit mass-spring cloth on world space vertices: a step minimizes the
+// inertia plus spring energy with Jacobi iterations sped up by Chebyshev
+// weights (rho). The state is kept as structure of arrays and the springs
+// as arrays of their ends and rest lengths, padded to whole blocks of
+// springBlock so the force kernel runs on full SIMD batches. The solver owns
+// every buffer the step uses and swaps them instead of copying, so a step
+// allocates nothing once they are sized.
+// An iteration is two passes split across the pool: every spring computes
+// its force into its own slot, then every vertex gathers the forces of its
+// springs from a CSR list and makes its own Jacobi update. No two tasks
+// write the same place, and every vertex sums in spring order whatever the
+// thread count.
+// The iterations stop once the largest residual, the unbalanced force on a
+// vertex as the velocity it would change in a step, falls below tolerance:
+// a resting cloth needs only minIterations, a struck one up to iterations.
+// With projective set, an iteration is a Projective Dynamics one instead:
+// the same spring forces (local projections) and gradient, then the whole
+// correction from the constant matrix mass / dt^2 + spring_k * Laplacian,
+// Cholesky factored once for the dt, mass, stiffness and pins it was built
+// with, at the cost of two triangular solves.
+class ClothSolver
+{
+public:
+    static const int springBlock = 8; // the widest SIMD_WIDTH
+
+    float mass = 1.0f;
+    float damping = 0.99f;
+    float rho = 0.995f;
+    float spring_k = 80000;
+    Vec3f g = Vec3f(0, -9.8f, 0);
+    int iterations = 32; // at most
+    int minIterations = 2;
+    float tolerance = 5e-3f; // m/s, above where float rounding stalls a cloth at rest
+    bool projective = false;
+    int projectiveIterations = 8; // at most, each costs the two solves
+    int springs = 0; // the rest of springA, springB and L pad the last block
+    std::vector<int> springA, springB; // the two ends of each spring
+    std::vector<float> L; // rest lengths
+    PointBuffer V;
+    std::vector<uint8_t> pinned; // vertices that keep their place
+    // the springs of vertex i are spring[springStart[i]] up to
+    // springStart[i + 1], as e * 2 + 1 where i is springB[e], else e * 2
+    std::vector<int> springStart, spring;
+    ThreadPool *pool = &ThreadPool::instance();
+    int itemsPerTask = 2048; // vertices or springs, a multiple of springBlock
+
+    int lastIterations = 0; // iterations the last step ran
+    float lastResidual = 0; // m/s, where the last iteration started from
+    long totalIterations = 0, steps = 0;
+
+    int size() const { return V.size(); }
+
+    // a spring per triangle edge, at rest at the lengths in X
+    void setMesh(const std::vector<Vec3f> &X, const std::vector<Mesh::Index> &triangles)
+    {
+        std::vector<int> _E(triangles.size() * 2);
+        for (int i = 0; i < triangles.size(); i += 3)
+        {
+            _E[i * 2 + 0] = triangles[i + 0];
+            _E[i * 2 + 1] = triangles[i + 1];
+            _E[i * 2 + 2] = triangles[i + 1];
+            _E[i * 2 + 3] = triangles[i + 2];
+            _E[i * 2 + 4] = triangles[i + 2];
+            _E[i * 2 + 5] = triangles[i + 0];
+        }
+        for (int i = 0; i < _E.size(); i += 2)
+        {
+            if (_E[i] > _E[i + 1])
+                std::swap(_E[i], _E[i + 1]);
+        }
+        QuickSort(_E, 0, _E.size() / 2 - 1);
+
+        springA.clear();
+        springB.clear();
+        for (int i = 0; i < _E.size(); i += 2)
+        {
+            if (i == 0 || _E[i + 0] != _E[i - 2] || _E[i + 1] != _E[i - 1])
+            {
+                springA.push_back(_E[i + 0]);
+                springB.push_back(_E[i + 1]);
+            }
+        }
+        springs = springA.size();
+        // padding springs from vertex 0 to itself, whose force is never read
+        int padded = (springs + springBlock - 1) / springBlock * springBlock;
+        springA.resize(padded, 0);
+        springB.resize(padded, 0);
+
+        springStart.assign(X.size() + 1, 0);
+        for (int e = 0; e < springs; e++)
+        {
+            springStart[springA[e] + 1]++;
+            springStart[springB[e] + 1]++;
+        }
+        for (int i = 0; i < X.size(); i++)
+            springStart[i + 1] += springStart[i];
+        spring.resize(springs * 2);
+        std::vector<int> fill(springStart.begin(), springStart.end() - 1);
+        for (int e = 0; e < springs; e++)
+        {
+            spring[fill[springA[e]]++] = e * 2;
+            spring[fill[springB[e]]++] = e * 2 + 1;
+        }
+        restLengths(X);
+        V.resize(X.size());
+        for (int i = 0; i < X.size(); i++)
+            V.set(i, Vec3f(0, 0, 0));
+        pinned.assign(X.size(), 0);
+        row.clear();
+        cholesky = SkylineCholesky();
+    }
+
+    void restLengths(const std::vector<Vec3f> &X)
+    {
+        L.assign(springA.size(), 0);
+        for (int e = 0; e < springs; e++)
+            L[e] = (X[springA[e]] - X[springB[e]]).mag();
+    }
+
+    // F[e] = force of spring e at X on springA[e], for e in [begin, end)
+    void springForcesScalar(const PointBuffer &X, PointBuffer &F, int begin, int end) const
+    {
+        for (int e = begin; e < end; e++)
+        {
+            int a = springA[e], b = springB[e];
+            float dx = X.x[a] - X.x[b], dy = X.y[a] - X.y[b], dz = X.z[a] - X.z[b];
+            float length = sqrtf(std::max(dx * dx + dy * dy + dz * dz, 1e-30f));
+            float s = spring_k * (1 - L[e] / length);
+            F.x[e] = s * dx;
+            F.y[e] = s * dy;
+            F.z[e] = s * dz;
+        }
+    }
+
+    // the same with 1 / length from the reciprocal square root estimate and
+    // one Newton step, to about 22 bits; begin and end on block boundaries
+    void springForces(const PointBuffer &X, PointBuffer &F, int begin, int end) const
+    {
+        int e = begin;
+#ifdef SIMD_WIDTH
+        simdf k = simdSet(spring_k), one = simdSet(1), half = simdSet(0.5f), threeHalves = simdSet(1.5f);
+        simdf tiny = simdSet(1e-30f);
+        alignas(32) float dx[SIMD_WIDTH], dy[SIMD_WIDTH], dz[SIMD_WIDTH];
+        for (; e + SIMD_WIDTH <= end; e += SIMD_WIDTH)
+        {
+            for (int l = 0; l < SIMD_WIDTH; l++)
+            {
+                int a = springA[e + l], b = springB[e + l];
+                dx[l] = X.x[a] - X.x[b];
+                dy[l] = X.y[a] - X.y[b];
+                dz[l] = X.z[a] - X.z[b];
+            }
+            simdf x = simdLoad(dx), y = simdLoad(dy), z = simdLoad(dz);
+            simdf length2 = simdMax(simdAdd(simdAdd(simdMul(x, x), simdMul(y, y)), simdMul(z, z)), tiny);
+            simdf r = simdRsqrt(length2);
+            r = simdMul(r, simdSub(threeHalves, simdMul(simdMul(half, length2), simdMul(r, r))));
+            simdf s = simdMul(k, simdSub(one, simdMul(simdLoad(&L[e]), r)));
+            simdStore(&F.x[e], simdMul(s, x));
+            simdStore(&F.y[e], simdMul(s, y));
+            simdStore(&F.z[e], simdMul(s, z));
+        }
+#endif
+        springForcesScalar(X, F, e, end);
+    }
+
+    // factors the Projective Dynamics matrix unless it is current: pinned
+    // vertices get rows of the identity, so their corrections stay zero
+    bool factorProjective(float dt)
+    {
+        int n = size();
+        if (cholesky.size() == n && factored.dt == dt && factored.mass == mass && factored.spring_k == spring_k &&
+            factored.pinned == pinned)
+            return true;
+        if (row.size() != n)
+        {
+            std::vector<int> neighbors(spring.size());
+            for (int s = 0; s < spring.size(); s++)
+            {
+                int e = spring[s] >> 1;
+                neighbors[s] = spring[s] & 1 ? springA[e] : springB[e];
+            }
+            reverseCuthillMcKee(springStart, neighbors, row);
+        }
+        std::vector<double> diagonal(n, (1.0 / dt) * mass * (1.0 / dt));
+        std::vector<SkylineCholesky::Entry> entries;
+        for (int e = 0; e < springs; e++)
+        {
+            int a = springA[e], b = springB[e];
+            diagonal[row[a]] += spring_k;
+            diagonal[row[b]] += spring_k;
+            if (!pinned[a] && !pinned[b])
+                entries.push_back({row[a], row[b], -spring_k});
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (pinned[i])
+                diagonal[row[i]] = 1;
+        }
+        factored = {dt, mass, spring_k, pinned};
+        if (cholesky.factor(diagonal, entries))
+            return true;
+        cholesky = SkylineCholesky();
+        return false;
+    }
+
+    // fn(begin, end) over [0, n), itemsPerTask at a time
+    template <class Fn>
+    void forRange(int n, Fn fn)
+    {
+        int tasks = (n + itemsPerTask - 1) / itemsPerTask;
+        pool->parallelFor(tasks, [&](int task) { fn(task * itemsPerTask, std::min(n, (task + 1) * itemsPerTask)); });
+    }
+
+    // worldX: world space vertices, moved in place over dt
+    void step(std::vector<Vec3f> &worldX, float dt)
+    {
+        int n = worldX.size();
+        X.assign(worldX);
+        XHat.resize(n);
+        lastX.resize(n);
+        nextX.resize(n);
+        F.resize(springA.size());
+        residuals.resize((n + itemsPerTask - 1) / itemsPerTask);
+        // Jacobi if the matrix is not positive definite, which it always is
+        bool direct = projective && factorProjective(dt);
+        if (direct)
+            G.resize(n);
+        forRange(n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                V.x[i] *= damping;
+                V.y[i] *= damping;
+                V.z[i] *= damping;
+                XHat.x[i] = X.x[i] += V.x[i] * dt;
+                XHat.y[i] = X.y[i] += V.y[i] * dt;
+                XHat.z[i] = X.z[i] += V.z[i] * dt;
+            }
+        });
+
+        float inertia = (1 / dt) * mass * (1 / dt);
+        float diagonal = inertia + 4 * spring_k;
+        Vec3f weight = mass * g;
+        lastIterations = 0;
+        int maxIterations = direct ? projectiveIterations : iterations;
+        for (int k = 0; k < maxIterations; k++)
+        {
+            float w = 0;
+            if (k == 0) w = 1;
+            else if (k == 1) w = 2 / (2 - rho * rho);
+            else w = 4 / (4 - rho * rho * w);
+            forRange(springA.size(), [&](int begin, int end) { springForces(X, F, begin, end); });
+            forRange(n, [&](int begin, int end) {
+                float residual2 = 0;
+                for (int i = begin; i < end; i++)
+                {
+                    if (direct && pinned[i])
+                    {
+                        G.x[row[i]] = G.y[row[i]] = G.z[row[i]] = 0;
+                        continue;
+                    }
+                    if (pinned[i])
+                    {
+                        nextX.x[i] = X.x[i];
+                        nextX.y[i] = X.y[i];
+                        nextX.z[i] = X.z[i];
+                        continue;
+                    }
+                    // the gradient of the energy at vertex i
+                    float gx = inertia * (X.x[i] - XHat.x[i]) - weight.x;
+                    float gy = inertia * (X.y[i] - XHat.y[i]) - weight.y;
+                    float gz = inertia * (X.z[i] - XHat.z[i]) - weight.z;
+                    for (int s = springStart[i]; s < springStart[i + 1]; s++)
+                    {
+                        int e = spring[s] >> 1;
+                        float sign = spring[s] & 1 ? -1.0f : 1.0f;
+                        gx += sign * F.x[e];
+                        gy += sign * F.y[e];
+                        gz += sign * F.z[e];
+                    }
+                    residual2 = std::max(residual2, gx * gx + gy * gy + gz * gz);
+                    if (direct)
+                    {
+                        G.x[row[i]] = gx;
+                        G.y[row[i]] = gy;
+                        G.z[row[i]] = gz;
+                        continue;
+                    }
+                    // lastX is stale on the first iteration, where w is 1
+                    nextX.x[i] = w * (X.x[i] - gx / diagonal) + (1 - w) * lastX.x[i];
+                    nextX.y[i] = w * (X.y[i] - gy / diagonal) + (1 - w) * lastX.y[i];
+                    nextX.z[i] = w * (X.z[i] - gz / diagonal) + (1 - w) * lastX.z[i];
+                }
+                residuals[begin / itemsPerTask] = residual2;
+            });
+            if (direct)
+            {
+                cholesky.solve(G.x.data(), G.y.data(), G.z.data());
+                forRange(n, [&](int begin, int end) {
+                    for (int i = begin; i < end; i++)
+                    {
+                        X.x[i] -= G.x[row[i]];
+                        X.y[i] -= G.y[row[i]];
+                        X.z[i] -= G.z[row[i]];
+                    }
+                });
+            }
+            else
+            {
+                // lastX takes X, X takes nextX
+                std::swap(lastX, X);
+                std::swap(X, nextX);
+            }
+
+            float residual2 = 0;
+            for (float r : residuals)
+                residual2 = std::max(residual2, r);
+            lastResidual = sqrtf(residual2) * dt / mass;
+            lastIterations = k + 1;
+            if (lastIterations >= minIterations && lastResidual < tolerance)
+                break;
+        }
+        totalIterations += lastIterations;
+        steps++;
+        forRange(n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                if (!pinned[i])
+                {
+                    V.x[i] += (X.x[i] - XHat.x[i]) * (1 / dt);
+                    V.y[i] += (X.y[i] - XHat.y[i]) * (1 / dt);
+                    V.z[i] += (X.z[i] - XHat.z[i]) * (1 / dt);
+                }
+                worldX[i] = X.get(i);
+            }
+        });
+    }
+
+    double averageIterations() const { return steps ? (double)totalIterations / steps : 0; }
+
+private:
+    std::vector<float> residuals; // squared, the largest of each task
+    PointBuffer X, XHat, lastX, nextX;
+    PointBuffer F; // of each spring on its first end
+    PointBuffer G; // the gradient, then the correction, in matrix row order
+    std::vector<int> row; // matrix row of each vertex
+    SkylineCholesky cholesky;
+    struct
+    {
+        float dt, mass, spring_k;
+        std::vector<uint8_t> pinned;
+    } factored; // what the matrix was built with
+};
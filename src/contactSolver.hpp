@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "al/math/al_Mat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "rigidBodies.hpp"
+
+using namespace al;
+
+// One point of a contact manifold. The impulses are accumulated over the
+// solver iterations and kept to the next step, where they are applied first
+// (warm starting) so a resting contact starts from last step's answer.
+struct ContactPoint
+{
+    uint64_t key = 0; // the features that made the point, to find it next step
+    Vec3f rA, rB; // from the centers of body a and b to the point
+    float depth = 0;
+    float normalImpulse = 0;
+    float tangentImpulse[2] = {0, 0};
+    float normalMass = 0, tangentMass[2] = {0, 0}; // 1 / effective mass along each axis
+    float bias = 0; // separating velocity the solver aims for
+};
+
+// The points between body a and body b (or the static scene when b is -1)
+// sharing one normal, which points from b to a.
+struct ContactManifold
+{
+    static const int maxPoints = 4;
+    uint64_t key = 0; // the body pair or body and static slot, see pairKey
+    int a = -1, b = -1;
+    Vec3f normal, tangent[2];
+    float friction = 0, restitution = 0;
+    float matchRadius = 0; // how far a point may move and keep its impulses
+    int count = 0;
+    ContactPoint points[maxPoints];
+
+    static uint64_t pairKey(int a, int b) { return (uint64_t)(uint32_t)a << 32 | (uint32_t)b; }
+    static uint64_t staticKey(int a, int slot) { return (uint64_t)(uint32_t)a << 32 | (1u << 31 | (uint32_t)slot); }
+
+    // unit normal and two tangents across it
+    void setNormal(Vec3f N)
+    {
+        normal = N;
+        Vec3f t = fabsf(N.x) < 0.57f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+        tangent[0] = t.cross(N).normalize();
+        tangent[1] = N.cross(tangent[0]);
+    }
+
+    // keeps the deepest candidate, the one farthest from it and the two
+    // spanning the largest area on either side of the line between them
+    void reduce(const std::vector<ContactPoint> &candidates)
+    {
+        count = 0;
+        if (candidates.empty())
+            return;
+        int first = 0;
+        for (int i = 1; i < candidates.size(); i++)
+        {
+            if (candidates[i].depth > candidates[first].depth)
+                first = i;
+        }
+        points[count++] = candidates[first];
+        Vec3f p0 = candidates[first].rA;
+
+        int second = -1;
+        float far = 1e-12f;
+        for (int i = 0; i < candidates.size(); i++)
+        {
+            Vec3f d = candidates[i].rA - p0;
+            d -= normal * d.dot(normal);
+            if (d.magSqr() > far)
+            {
+                far = d.magSqr();
+                second = i;
+            }
+        }
+        if (second < 0)
+            return;
+        points[count++] = candidates[second];
+        Vec3f edge = candidates[second].rA - p0;
+
+        int left = -1, right = -1;
+        float leftArea = 1e-12f, rightArea = -1e-12f;
+        for (int i = 0; i < candidates.size(); i++)
+        {
+            float area = edge.cross(candidates[i].rA - p0).dot(normal);
+            if (area > leftArea)
+            {
+                leftArea = area;
+                left = i;
+            }
+            if (area < rightArea)
+            {
+                rightArea = area;
+                right = i;
+            }
+        }
+        if (left >= 0)
+            points[count++] = candidates[left];
+        if (right >= 0)
+            points[count++] = candidates[right];
+    }
+};
+
+// Projected Gauss-Seidel over the contact points: every iteration visits the
+// points in order and corrects the accumulated impulse of each so that its
+// relative velocity meets the target, clamped to push only and to the
+// friction cone. Stops after `iterations` or once no impulse changes a
+// relative velocity by more than `tolerance`.
+class ContactSolver
+{
+public:
+    int iterations = 10;
+    float tolerance = 1e-3f; // m/s
+    float baumgarte = 0.2f; // fraction of the depth past slop removed per step
+    float slop = 0.01f; // depth left alone, so resting contacts stay touching
+    float restitutionThreshold = 1.0f; // slower approaches do not bounce
+    bool warmStarting = true;
+    std::vector<ContactManifold> manifolds; // filled between begin and solve
+
+    int lastIterations = 0; // iterations the last solve ran
+    long totalIterations = 0, solves = 0;
+
+    // the manifolds of the last step become the warm start of the next ones
+    void begin()
+    {
+        std::swap(manifolds, lastManifolds);
+        manifolds.clear();
+        lastIndex.clear();
+        for (int m = 0; m < lastManifolds.size(); m++)
+            lastIndex[lastManifolds[m].key] = m;
+    }
+
+    void solve(RigidBodies &bodies, float dt)
+    {
+        lastIterations = 0;
+        if (manifolds.empty())
+            return;
+        prepare(bodies, dt);
+        if (warmStarting)
+        {
+            for (auto &m : manifolds)
+            {
+                for (int k = 0; k < m.count; k++)
+                {
+                    auto &c = m.points[k];
+                    apply(bodies, m, c, m.normal * c.normalImpulse + m.tangent[0] * c.tangentImpulse[0] +
+                                            m.tangent[1] * c.tangentImpulse[1]);
+                }
+            }
+        }
+        for (int it = 0; it < iterations; it++)
+        {
+            float change = 0;
+            for (auto &m : manifolds)
+            {
+                for (int k = 0; k < m.count; k++)
+                {
+                    auto &c = m.points[k];
+                    // friction first, inside the cone of the current normal impulse
+                    for (int t = 0; t < 2; t++)
+                    {
+                        float vt = relativeVelocity(bodies, m, c).dot(m.tangent[t]);
+                        float limit = m.friction * c.normalImpulse;
+                        float old = c.tangentImpulse[t];
+                        c.tangentImpulse[t] = std::min(std::max(old - vt * c.tangentMass[t], -limit), limit);
+                        float d = c.tangentImpulse[t] - old;
+                        apply(bodies, m, c, m.tangent[t] * d);
+                        change = std::max(change, fabsf(d) / c.tangentMass[t]);
+                    }
+                    float vn = relativeVelocity(bodies, m, c).dot(m.normal);
+                    float old = c.normalImpulse;
+                    c.normalImpulse = std::max(old - (vn - c.bias) * c.normalMass, 0.0f);
+                    float d = c.normalImpulse - old;
+                    apply(bodies, m, c, m.normal * d);
+                    change = std::max(change, fabsf(d) / c.normalMass);
+                }
+            }
+            lastIterations = it + 1;
+            if (change < tolerance)
+                break;
+        }
+        totalIterations += lastIterations;
+        solves++;
+    }
+
+    double averageIterations() const { return solves ? (double)totalIterations / solves : 0; }
+
+private:
+    std::vector<ContactManifold> lastManifolds;
+    std::unordered_map<uint64_t, int> lastIndex;
+    std::vector<float> invMass;
+    std::vector<Mat4f> invInertia; // world frame, upper 3x3
+
+    // effective masses, targets, and the impulses carried over from the
+    // point nearest to each one in the last step's manifold of the pair
+    void prepare(RigidBodies &bodies, float dt)
+    {
+        invMass.resize(bodies.size());
+        invInertia.resize(bodies.size());
+        for (auto &m : manifolds)
+        {
+            for (int body : {m.a, m.b})
+            {
+                if (body < 0)
+                    continue;
+                if (!bodies.isAwake(body))
+                {
+                    invMass[body] = 0;
+                    invInertia[body] = Mat4f(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+                    continue;
+                }
+                invMass[body] = 1 / bodies.mass[body];
+                // R * I_ref^-1 * R^T
+                Mat4f R;
+                bodies.orientation(body).toMatrix(R.elems());
+                const Mat4f &I = bodies.I_refInverse[body];
+                Mat4f &W = invInertia[body];
+                for (int i = 0; i < 3; i++)
+                {
+                    for (int j = 0; j < 3; j++)
+                    {
+                        float sum = 0;
+                        for (int k = 0; k < 3; k++)
+                            for (int l = 0; l < 3; l++)
+                                sum += R(i, k) * I(k, l) * R(j, l);
+                        W(i, j) = sum;
+                    }
+                }
+            }
+        }
+
+        for (auto &m : manifolds)
+        {
+            const ContactManifold *last = nullptr;
+            auto found = lastIndex.find(m.key);
+            if (found != lastIndex.end())
+                last = &lastManifolds[found->second];
+            for (int k = 0; k < m.count; k++)
+            {
+                auto &c = m.points[k];
+                c.normalMass = 1 / effectiveMass(m, c, m.normal);
+                for (int t = 0; t < 2; t++)
+                    c.tangentMass[t] = 1 / effectiveMass(m, c, m.tangent[t]);
+
+                float vn = relativeVelocity(bodies, m, c).dot(m.normal);
+                c.bias = baumgarte / dt * std::max(c.depth - slop, 0.0f);
+                if (vn < -restitutionThreshold)
+                    c.bias = std::max(c.bias, -m.restitution * vn);
+
+                c.normalImpulse = c.tangentImpulse[0] = c.tangentImpulse[1] = 0;
+                if (!last)
+                    continue;
+                const ContactPoint *match = nullptr;
+                float nearest = m.matchRadius * m.matchRadius;
+                for (int l = 0; l < last->count; l++)
+                {
+                    auto &o = last->points[l];
+                    if (o.key == c.key)
+                    {
+                        match = &o;
+                        break;
+                    }
+                    float d = (o.rA - c.rA).magSqr();
+                    if (d < nearest)
+                    {
+                        nearest = d;
+                        match = &o;
+                    }
+                }
+                if (match)
+                {
+                    // the tangents may have turned, carry the friction as a vector
+                    Vec3f friction = last->tangent[0] * match->tangentImpulse[0] +
+                                     last->tangent[1] * match->tangentImpulse[1];
+                    c.normalImpulse = match->normalImpulse;
+                    c.tangentImpulse[0] = friction.dot(m.tangent[0]);
+                    c.tangentImpulse[1] = friction.dot(m.tangent[1]);
+                }
+            }
+        }
+    }
+
+    Vec3f inertiaTimes(int body, const Vec3f &v) const
+    {
+        const Mat4f &W = invInertia[body];
+        return Vec3f(W(0, 0) * v.x + W(0, 1) * v.y + W(0, 2) * v.z, W(1, 0) * v.x + W(1, 1) * v.y + W(1, 2) * v.z,
+                     W(2, 0) * v.x + W(2, 1) * v.y + W(2, 2) * v.z);
+    }
+
+    // relative velocity change per unit impulse along d
+    float effectiveMass(const ContactManifold &m, const ContactPoint &c, const Vec3f &d) const
+    {
+        Vec3f ra = c.rA.cross(d);
+        float k = invMass[m.a] + inertiaTimes(m.a, ra).dot(ra);
+        if (m.b >= 0)
+        {
+            Vec3f rb = c.rB.cross(d);
+            k += invMass[m.b] + inertiaTimes(m.b, rb).dot(rb);
+        }
+        return std::max(k, 1e-12f);
+    }
+
+    // velocity of a's point relative to b's
+    Vec3f relativeVelocity(const RigidBodies &bodies, const ContactManifold &m, const ContactPoint &c) const
+    {
+        Vec3f v = bodies.velocity(m.a) + bodies.angularVelocity(m.a).cross(c.rA);
+        if (m.b >= 0)
+            v -= bodies.velocity(m.b) + bodies.angularVelocity(m.b).cross(c.rB);
+        return v;
+    }
+
+    // impulse P on a at the point, -P on b
+    void apply(RigidBodies &bodies, const ContactManifold &m, const ContactPoint &c, const Vec3f &P)
+    {
+        Vec3f dv = P * invMass[m.a], dw = inertiaTimes(m.a, c.rA.cross(P));
+        bodies.velocity(m.a, bodies.velocity(m.a) + dv);
+        bodies.angularVelocity(m.a, bodies.angularVelocity(m.a) + dw);
+        if (m.b < 0)
+            return;
+        dv = P * -invMass[m.b];
+        dw = inertiaTimes(m.b, c.rB.cross(P)) * -1;
+        bodies.velocity(m.b, bodies.velocity(m.b) + dv);
+        bodies.angularVelocity(m.b, bodies.angularVelocity(m.b) + dw);
+    }
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "al/math/al_Vec.hpp"
+
+using namespace al;
+
+// Triangulated convex hull of a point set. Faces wind counterclockwise seen
+// from outside; normals[f] and offsets[f] are the outward plane of face f.
+// The neighbors of vertex i are neighbors[neighborStart[i]] up to
+// neighborStart[i + 1]; extremes are the support vertices of 26 directions
+// spread around the sphere, where support searches start.
+struct ConvexHull
+{
+    std::vector<Vec3f> vertices;
+    std::vector<std::array<int, 3>> faces; // indices into vertices
+    std::vector<Vec3f> normals;
+    std::vector<float> offsets; // p . normal = offset on the face
+    std::vector<int> neighborStart, neighbors;
+    std::vector<int> extremes;
+
+    bool empty() const { return vertices.empty(); }
+
+    // the vertex farthest along d, climbing from the best extreme to the
+    // neighbor farther along d until none is: on a convex hull the first
+    // local maximum is the global one
+    int support(const Vec3f &d) const
+    {
+        int best = extremes[0];
+        float bestDot = vertices[best].dot(d);
+        for (int e : extremes)
+        {
+            float dot = vertices[e].dot(d);
+            if (dot > bestDot)
+            {
+                bestDot = dot;
+                best = e;
+            }
+        }
+        for (bool climbing = true; climbing;)
+        {
+            climbing = false;
+            for (int k = neighborStart[best]; k < neighborStart[best + 1]; k++)
+            {
+                float dot = vertices[neighbors[k]].dot(d);
+                if (dot > bestDot)
+                {
+                    bestDot = dot;
+                    best = neighbors[k];
+                    climbing = true;
+                }
+            }
+        }
+        return best;
+    }
+
+    void prepareSupport()
+    {
+        std::vector<std::pair<int, int>> edges;
+        for (auto &f : faces)
+        {
+            for (int k = 0; k < 3; k++)
+                edges.push_back({f[k], f[(k + 1) % 3]}); // each edge once per direction
+        }
+        std::sort(edges.begin(), edges.end());
+        neighborStart.assign(vertices.size() + 1, 0);
+        neighbors.clear();
+        for (auto &e : edges)
+        {
+            neighborStart[e.first + 1]++;
+            neighbors.push_back(e.second);
+        }
+        for (int i = 0; i < vertices.size(); i++)
+            neighborStart[i + 1] += neighborStart[i];
+
+        extremes.clear();
+        for (int x = -1; x <= 1; x++)
+        {
+            for (int y = -1; y <= 1; y++)
+            {
+                for (int z = -1; z <= 1; z++)
+                {
+                    if (x == 0 && y == 0 && z == 0)
+                        continue;
+                    int best = 0;
+                    for (int i = 1; i < vertices.size(); i++)
+                    {
+                        if (vertices[i].dot(Vec3f(x, y, z)) > vertices[best].dot(Vec3f(x, y, z)))
+                            best = i;
+                    }
+                    extremes.push_back(best);
+                }
+            }
+        }
+    }
+
+    // largest distance of p outside any face, negative inside
+    float distance(const Vec3f &p) const
+    {
+        float outside = -1e30f;
+        for (int f = 0; f < faces.size(); f++)
+            outside = std::max(outside, p.dot(normals[f]) - offsets[f]);
+        return outside;
+    }
+};
+
+// Quickhull: start from a tetrahedron of extreme points, then repeatedly take
+// the point farthest outside a face, remove every face it sees and close
+// the hole with a fan of faces from the horizon to the point. Each point
+// waits in the outside list of one face, so only those lists are rescanned.
+// Points within eps of the hull are dropped, but a face is seen as soon as
+// the point is in front of it at all: with eps there too, nearly coplanar
+// faces leave holes in the horizon and the hull falls apart.
+// Flat or degenerate input leaves the hull empty.
+void quickhull(const std::vector<Vec3f> &points, ConvexHull &hull)
+{
+    hull = ConvexHull();
+    if (points.size() < 4)
+        return;
+
+    Vec3f min = points[0], max = points[0];
+    for (auto &p : points)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+        }
+    }
+    float eps = 1e-5f * (max - min).mag();
+
+    // initial tetrahedron: the extremes on the widest axis, the point
+    // farthest from their line, then the one farthest from their plane
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+    {
+        if (max[k] - min[k] > max[axis] - min[axis])
+            axis = k;
+    }
+    int i0 = 0, i1 = 0;
+    for (int i = 0; i < points.size(); i++)
+    {
+        if (points[i][axis] < points[i0][axis])
+            i0 = i;
+        if (points[i][axis] > points[i1][axis])
+            i1 = i;
+    }
+    Vec3f line = (points[i1] - points[i0]).normalize();
+    int i2 = -1;
+    float far = eps;
+    for (int i = 0; i < points.size(); i++)
+    {
+        Vec3f d = points[i] - points[i0];
+        float dist = (d - line * d.dot(line)).mag();
+        if (dist > far)
+        {
+            far = dist;
+            i2 = i;
+        }
+    }
+    if (i2 < 0)
+        return;
+    Vec3f planeN = (points[i1] - points[i0]).cross(points[i2] - points[i0]).normalize();
+    int i3 = -1;
+    far = eps;
+    for (int i = 0; i < points.size(); i++)
+    {
+        float dist = fabsf((points[i] - points[i0]).dot(planeN));
+        if (dist > far)
+        {
+            far = dist;
+            i3 = i;
+        }
+    }
+    if (i3 < 0)
+        return;
+
+    struct Face
+    {
+        int v[3];
+        Vec3f n;
+        float d;
+        std::vector<int> outside;
+        bool dead = false;
+    };
+    std::vector<Face> faces;
+    auto addFace = [&](int a, int b, int c) {
+        Face f;
+        f.v[0] = a;
+        f.v[1] = b;
+        f.v[2] = c;
+        f.n = (points[b] - points[a]).cross(points[c] - points[a]).normalize();
+        f.d = f.n.dot(points[a]);
+        faces.push_back(f);
+        return (int)faces.size() - 1;
+    };
+    // wind the tetrahedron outwards
+    if ((points[i3] - points[i0]).dot(planeN) > 0)
+        std::swap(i1, i2);
+    addFace(i0, i1, i2);
+    addFace(i0, i3, i1);
+    addFace(i1, i3, i2);
+    addFace(i2, i3, i0);
+
+    // hand each point to a face it is outside of, if any
+    auto assign = [&](int p, int firstFace) {
+        for (int f = firstFace; f < faces.size(); f++)
+        {
+            if (!faces[f].dead && points[p].dot(faces[f].n) - faces[f].d > eps)
+            {
+                faces[f].outside.push_back(p);
+                return;
+            }
+        }
+    };
+    for (int i = 0; i < points.size(); i++)
+    {
+        if (i != i0 && i != i1 && i != i2 && i != i3)
+            assign(i, 0);
+    }
+
+    std::vector<int> live = {0, 1, 2, 3}, visible;
+    std::vector<std::pair<int, int>> edges, horizon;
+    std::vector<int> orphans;
+    for (int f = 0; f < faces.size(); f++)
+    {
+        if (faces[f].dead || faces[f].outside.empty())
+            continue;
+        // farthest point outside this face
+        int eye = faces[f].outside[0];
+        float eyeDist = -1;
+        for (int p : faces[f].outside)
+        {
+            float dist = points[p].dot(faces[f].n) - faces[f].d;
+            if (dist > eyeDist)
+            {
+                eyeDist = dist;
+                eye = p;
+            }
+        }
+
+        visible.clear();
+        edges.clear();
+        for (int g : live)
+        {
+            if (points[eye].dot(faces[g].n) - faces[g].d > 0)
+            {
+                visible.push_back(g);
+                for (int k = 0; k < 3; k++)
+                    edges.push_back({faces[g].v[k], faces[g].v[(k + 1) % 3]});
+            }
+        }
+        // edges seen from one side only
+        horizon.clear();
+        for (auto &e : edges)
+        {
+            if (std::find(edges.begin(), edges.end(), std::make_pair(e.second, e.first)) == edges.end())
+                horizon.push_back(e);
+        }
+
+        orphans.clear();
+        for (int g : visible)
+        {
+            faces[g].dead = true;
+            for (int p : faces[g].outside)
+            {
+                if (p != eye)
+                    orphans.push_back(p);
+            }
+            faces[g].outside.clear();
+            faces[g].outside.shrink_to_fit();
+        }
+        live.erase(std::remove_if(live.begin(), live.end(), [&](int g) { return faces[g].dead; }), live.end());
+        int firstNew = faces.size();
+        for (auto &e : horizon)
+            live.push_back(addFace(e.first, e.second, eye));
+        for (int p : orphans)
+            assign(p, firstNew);
+        // faces are only appended, so the loop reaches the new ones
+    }
+
+    // compact the live faces and the vertices they use
+    std::vector<int> index(points.size(), -1);
+    for (auto &f : faces)
+    {
+        if (f.dead)
+            continue;
+        std::array<int, 3> face;
+        for (int k = 0; k < 3; k++)
+        {
+            if (index[f.v[k]] < 0)
+            {
+                index[f.v[k]] = hull.vertices.size();
+                hull.vertices.push_back(points[f.v[k]]);
+            }
+            face[k] = index[f.v[k]];
+        }
+        hull.faces.push_back(face);
+        hull.normals.push_back(f.n);
+        hull.offsets.push_back(f.d);
+    }
+    hull.prepareSupport();
+}
+
+// whether every point lies on the hull, within tolerance
+bool isConvex(const std::vector<Vec3f> &points, const ConvexHull &hull, float tolerance)
+{
+    if (hull.empty())
+        return false;
+    for (auto &p : points)
+    {
+        if (hull.distance(p) < -tolerance)
+            return false;
+    }
+    return true;
+}
+
+// Picks budget points spread over a shape: up to half of them from the hull
+// vertices, the extremes a body rests on, then the rest from candidates
+// (e.g. octree leaf centers). Each pick is the point farthest from all
+// picked so far. weights[i] is how many candidates are nearest to point i.
+void proxyPoints(const ConvexHull &hull, const std::vector<Vec3f> &candidates, int budget,
+                 std::vector<Vec3f> &proxy, std::vector<float> &weights)
+{
+    proxy.clear();
+    // adds up to count points of from, farthest first
+    auto pick = [&](const std::vector<Vec3f> &from, int count) {
+        std::vector<float> nearest(from.size(), 1e30f);
+        for (auto &p : proxy)
+        {
+            for (int i = 0; i < from.size(); i++)
+                nearest[i] = std::min(nearest[i], (from[i] - p).magSqr());
+        }
+        for (int picked = 0; picked < count; picked++)
+        {
+            int far = -1;
+            float farDist = proxy.empty() ? -1 : 0;
+            for (int i = 0; i < from.size(); i++)
+            {
+                if (nearest[i] > farDist)
+                {
+                    farDist = nearest[i];
+                    far = i;
+                }
+            }
+            if (far < 0)
+                return; // every point is picked
+            proxy.push_back(from[far]);
+            for (int i = 0; i < from.size(); i++)
+                nearest[i] = std::min(nearest[i], (from[i] - from[far]).magSqr());
+        }
+    };
+    pick(hull.vertices, std::min<int>(hull.vertices.size(), std::max(budget / 2, 1)));
+    pick(candidates, budget - proxy.size());
+
+    weights.assign(proxy.size(), 0);
+    for (auto &c : candidates)
+    {
+        int best = 0;
+        for (int i = 1; i < proxy.size(); i++)
+        {
+            if ((c - proxy[i]).magSqr() < (c - proxy[best]).magSqr())
+                best = i;
+        }
+        weights[best] += 1;
+    }
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "al/graphics/al_Mesh.hpp"
+#include "al/math/al_Vec.hpp"
+
+using namespace al;
+
+// point of triangle abc nearest to p
+inline Vec3f closestPointOnTriangle(const Vec3f &p, const Vec3f &a, const Vec3f &b, const Vec3f &c)
+{
+    Vec3f ab = b - a, ac = c - a, ap = p - a;
+    float d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0 && d2 <= 0)
+        return a;
+    Vec3f bp = p - b;
+    float d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0 && d4 <= d3)
+        return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+        return a + ab * (d1 / (d1 - d3));
+    Vec3f cp = p - c;
+    float d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0 && d5 <= d6)
+        return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+        return a + ac * (d2 / (d2 - d6));
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    float denom = 1 / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Signed distance to a triangle mesh, negative inside, on a grid in the
+// mesh's own frame. The grid is cut into bricks of brickSize cells: bricks
+// the surface passes near keep every node, the others only their corners,
+// which a coarse grid of brick corners holds for the whole field. Samples
+// are trilinear, so the gradient comes with the value. Away from the
+// surface the field is only as fine as the bricks, which is enough to tell
+// inside from outside and which way the surface is.
+class SignedDistanceField
+{
+public:
+    int resolution = 64; // cells along the longest side of the mesh
+    int brickSize = 8; // cells along a brick side
+
+    Vec3f origin; // the corner node
+    float cell = 0;
+    int bricks[3] = {0, 0, 0};
+    std::vector<int> brickIndex; // per brick, its first value in brickData or -1
+    std::vector<float> brickData; // (brickSize + 1)^3 nodes per fine brick, x fastest
+    std::vector<float> coarse; // the brick corners, (bricks + 1) per axis
+
+    bool empty() const { return coarse.empty(); }
+
+    size_t memoryBytes() const
+    {
+        return sizeof(*this) + brickIndex.size() * sizeof(int) + (brickData.size() + coarse.size()) * sizeof(float);
+    }
+
+    // vertices and triangle indices of a closed mesh; small holes are fine,
+    // as the inside is whatever at least two of three axis rays say it is
+    void build(const std::vector<Vec3f> &vertices, const std::vector<Mesh::Index> &indices)
+    {
+        brickIndex.clear();
+        brickData.clear();
+        coarse.clear();
+        if (vertices.empty() || indices.size() < 3)
+            return;
+
+        Vec3f min = vertices[0], max = vertices[0];
+        for (auto &v : vertices)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                min[k] = std::min(min[k], v[k]);
+                max[k] = std::max(max[k], v[k]);
+            }
+        }
+        Vec3f extent = max - min;
+        cell = std::max(std::max(extent.x, extent.y), extent.z) / resolution;
+        if (cell <= 0)
+            return;
+        // two cells of outside around the mesh, rounded up to whole bricks
+        int nodes[3];
+        for (int k = 0; k < 3; k++)
+        {
+            int cells = (int)ceilf(extent[k] / cell) + 4;
+            bricks[k] = (cells + brickSize - 1) / brickSize;
+            nodes[k] = bricks[k] * brickSize + 1;
+            origin[k] = min[k] + extent[k] * 0.5f - bricks[k] * brickSize * cell * 0.5f;
+        }
+        auto node = [&](int x, int y, int z) { return (z * nodes[1] + y) * nodes[0] + x; };
+        auto position = [&](int x, int y, int z) { return origin + Vec3f(x, y, z) * cell; };
+        int count = nodes[0] * nodes[1] * nodes[2];
+
+        // unsigned distance: exact at the corners of the cells each triangle
+        // passes through, then the nearest surface point is handed on to
+        // neighbors in a sweep each way
+        std::vector<float> distance(count, 1e30f);
+        std::vector<Vec3f> nearest(count);
+        for (int t = 0; t + 2 < indices.size(); t += 3)
+        {
+            const Vec3f &a = vertices[indices[t]], &b = vertices[indices[t + 1]], &c = vertices[indices[t + 2]];
+            int lo[3], hi[3];
+            for (int k = 0; k < 3; k++)
+            {
+                float tmin = std::min(std::min(a[k], b[k]), c[k]), tmax = std::max(std::max(a[k], b[k]), c[k]);
+                lo[k] = std::max((int)floorf((tmin - origin[k]) / cell), 0);
+                hi[k] = std::min((int)ceilf((tmax - origin[k]) / cell), nodes[k] - 1);
+            }
+            for (int z = lo[2]; z <= hi[2]; z++)
+            {
+                for (int y = lo[1]; y <= hi[1]; y++)
+                {
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                    {
+                        Vec3f p = position(x, y, z);
+                        Vec3f q = closestPointOnTriangle(p, a, b, c);
+                        float d = (p - q).mag();
+                        int i = node(x, y, z);
+                        if (d < distance[i])
+                        {
+                            distance[i] = d;
+                            nearest[i] = q;
+                        }
+                    }
+                }
+            }
+        }
+        for (int direction : {1, -1})
+        {
+            int first = direction > 0 ? 0 : count - 1;
+            for (int i = first; i >= 0 && i < count; i += direction)
+            {
+                int x = i % nodes[0], y = i / nodes[0] % nodes[1], z = i / (nodes[0] * nodes[1]);
+                Vec3f p = position(x, y, z);
+                for (int dz = -1; dz <= 1; dz++)
+                {
+                    for (int dy = -1; dy <= 1; dy++)
+                    {
+                        for (int dx = -1; dx <= 1; dx++)
+                        {
+                            int nx = x + dx, ny = y + dy, nz = z + dz;
+                            if (nx < 0 || ny < 0 || nz < 0 || nx >= nodes[0] || ny >= nodes[1] || nz >= nodes[2])
+                                continue;
+                            int j = node(nx, ny, nz);
+                            // only the neighbors this sweep has been through
+                            if ((j - i) * direction >= 0 || distance[j] >= 1e30f)
+                                continue;
+                            float d = (p - nearest[j]).mag();
+                            if (d < distance[i])
+                            {
+                                distance[i] = d;
+                                nearest[i] = nearest[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // sign: the crossings of the mesh along each grid line through the
+        // nodes, in the three axis directions; inside on two of three
+        std::vector<uint8_t> votes(count, 0);
+        std::vector<std::vector<float>> crossings;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int u = (axis + 1) % 3, v = (axis + 2) % 3;
+            crossings.assign(nodes[u] * nodes[v], std::vector<float>());
+            for (int t = 0; t + 2 < indices.size(); t += 3)
+            {
+                const Vec3f &a = vertices[indices[t]], &b = vertices[indices[t + 1]], &c = vertices[indices[t + 2]];
+                float area = (b[u] - a[u]) * (c[v] - a[v]) - (b[v] - a[v]) * (c[u] - a[u]);
+                if (fabsf(area) < 1e-20f)
+                    continue; // edge on, the other triangles of the line cover it
+                int lo[2], hi[2];
+                for (int k = 0; k < 2; k++)
+                {
+                    int w = k ? v : u;
+                    float tmin = std::min(std::min(a[w], b[w]), c[w]), tmax = std::max(std::max(a[w], b[w]), c[w]);
+                    lo[k] = std::max((int)ceilf((tmin - origin[w]) / cell), 0);
+                    hi[k] = std::min((int)floorf((tmax - origin[w]) / cell), nodes[w] - 1);
+                }
+                for (int j = lo[1]; j <= hi[1]; j++)
+                {
+                    for (int i = lo[0]; i <= hi[0]; i++)
+                    {
+                        float pu = origin[u] + i * cell, pv = origin[v] + j * cell;
+                        // barycentric coordinates of the line in the triangle's shadow
+                        float wa = ((b[u] - pu) * (c[v] - pv) - (b[v] - pv) * (c[u] - pu)) / area;
+                        float wb = ((c[u] - pu) * (a[v] - pv) - (c[v] - pv) * (a[u] - pu)) / area;
+                        float wc = 1 - wa - wb;
+                        if (wa < 0 || wb < 0 || wc < 0)
+                            continue;
+                        crossings[j * nodes[u] + i].push_back(wa * a[axis] + wb * b[axis] + wc * c[axis]);
+                    }
+                }
+            }
+            for (int j = 0; j < nodes[v]; j++)
+            {
+                for (int i = 0; i < nodes[u]; i++)
+                {
+                    auto &line = crossings[j * nodes[u] + i];
+                    std::sort(line.begin(), line.end());
+                    int passed = 0;
+                    for (int s = 0; s < nodes[axis]; s++)
+                    {
+                        float p = origin[axis] + s * cell;
+                        while (passed < line.size() && line[passed] < p)
+                            passed++;
+                        int at[3];
+                        at[axis] = s;
+                        at[u] = i;
+                        at[v] = j;
+                        if (passed % 2 == 1)
+                            votes[node(at[0], at[1], at[2])]++;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (votes[i] >= 2)
+                distance[i] = -distance[i];
+        }
+
+        // bricks the surface passes within two cells of keep their nodes
+        int side = brickSize + 1;
+        brickIndex.assign(bricks[0] * bricks[1] * bricks[2], -1);
+        float near = 2 * cell;
+        for (int bz = 0; bz < bricks[2]; bz++)
+        {
+            for (int by = 0; by < bricks[1]; by++)
+            {
+                for (int bx = 0; bx < bricks[0]; bx++)
+                {
+                    float closest = 1e30f;
+                    for (int z = 0; z < side; z++)
+                        for (int y = 0; y < side; y++)
+                            for (int x = 0; x < side; x++)
+                                closest = std::min(closest, fabsf(distance[node(bx * brickSize + x, by * brickSize + y,
+                                                                                 bz * brickSize + z)]));
+                    if (closest >= near)
+                        continue;
+                    brickIndex[(bz * bricks[1] + by) * bricks[0] + bx] = brickData.size();
+                    for (int z = 0; z < side; z++)
+                        for (int y = 0; y < side; y++)
+                            for (int x = 0; x < side; x++)
+                                brickData.push_back(
+                                    distance[node(bx * brickSize + x, by * brickSize + y, bz * brickSize + z)]);
+                }
+            }
+        }
+        for (int z = 0; z <= bricks[2]; z++)
+            for (int y = 0; y <= bricks[1]; y++)
+                for (int x = 0; x <= bricks[0]; x++)
+                    coarse.push_back(distance[node(x * brickSize, y * brickSize, z * brickSize)]);
+    }
+
+    // distance at p in the mesh's frame and its gradient, which is close to
+    // unit length near the surface. Past the grid, the distance to the grid
+    // is added to the value at its boundary.
+    float sample(const Vec3f &p, Vec3f &gradient) const
+    {
+        if (empty())
+        {
+            gradient = Vec3f(0);
+            return 1e30f;
+        }
+        Vec3f g = (p - origin) / cell, clamped;
+        int brick[3];
+        for (int k = 0; k < 3; k++)
+        {
+            clamped[k] = std::min(std::max(g[k], 0.0f), bricks[k] * brickSize - 1e-3f);
+            brick[k] = (int)clamped[k] / brickSize;
+        }
+        Vec3f outside = (g - clamped) * cell;
+
+        int index = brickIndex[(brick[2] * bricks[1] + brick[1]) * bricks[0] + brick[0]];
+        float d;
+        if (index >= 0)
+        {
+            int side = brickSize + 1;
+            d = trilinear(&brickData[index], side, side * side, clamped - Vec3f(brick[0], brick[1], brick[2]) * brickSize,
+                          cell, gradient);
+        }
+        else
+        {
+            int stride[2] = {bricks[0] + 1, (bricks[0] + 1) * (bricks[1] + 1)};
+            const float *corner = &coarse[brick[2] * stride[1] + brick[1] * stride[0] + brick[0]];
+            d = trilinear(corner, stride[0], stride[1], clamped / brickSize - Vec3f(brick[0], brick[1], brick[2]),
+                          cell * brickSize, gradient);
+        }
+        float away = outside.mag();
+        if (away > 0)
+        {
+            d += away;
+            gradient = outside / away;
+        }
+        return d;
+    }
+
+private:
+    // values of the 8 corners of a cell starting at v, rows y apart and
+    // slices z apart, at f in [0, 1]^3 of a cell of the given size
+    static float trilinear(const float *v, int y, int z, Vec3f f, float size, Vec3f &gradient)
+    {
+        int i[3] = {(int)f.x, (int)f.y, (int)f.z};
+        const float *c = v + i[2] * z + i[1] * y + i[0];
+        float fx = f.x - i[0], fy = f.y - i[1], fz = f.z - i[2];
+        float c00 = c[0] + (c[1] - c[0]) * fx, c10 = c[y] + (c[y + 1] - c[y]) * fx;
+        float c01 = c[z] + (c[z + 1] - c[z]) * fx, c11 = c[z + y] + (c[z + y + 1] - c[z + y]) * fx;
+        float c0 = c00 + (c10 - c00) * fy, c1 = c01 + (c11 - c01) * fy;
+        float dx0 = (c[1] - c[0]) + ((c[y + 1] - c[y]) - (c[1] - c[0])) * fy;
+        float dx1 = (c[z + 1] - c[z]) + ((c[z + y + 1] - c[z + y]) - (c[z + 1] - c[z])) * fy;
+        gradient = Vec3f(dx0 + (dx1 - dx0) * fz, (c10 - c00) + ((c11 - c01) - (c10 - c00)) * fz, c1 - c0) / size;
+        return c0 + (c1 - c0) * fz;
+    }
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Turns frame times into a whole number of fixed physics steps. What is left
+// over waits in the accumulator for the next frame, and alpha() tells how far
+// the drawn frame lies between the last two steps. A frame that would need
+// more than maxSteps drops the rest of its time: the world slows down for a
+// moment instead of every later frame falling further behind.
+struct FixedTimestep
+{
+    float step = 0.016f;
+    int maxSteps = 4;
+    double accumulator = 0;
+    int droppedFrames = 0; // frames that hit maxSteps
+
+    // steps to run for a frame that took frameDt
+    int advance(double frameDt)
+    {
+        accumulator += std::max(frameDt, 0.0);
+        int steps = accumulator / step;
+        if (steps > maxSteps)
+        {
+            steps = maxSteps;
+            accumulator = std::fmod(accumulator, (double)step);
+            droppedFrames++;
+        }
+        else
+        {
+            accumulator -= steps * (double)step;
+        }
+        return steps;
+    }
+
+    float alpha() const { return std::min(accumulator / step, 1.0); }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "al/math/al_Mat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "convexHull.hpp"
+
+using namespace al;
+
+// A ConvexHull placed in the world: p -> R * p + pos, R any linear map
+// (rotation times scale for a RigidObject).
+struct ConvexShape
+{
+    const ConvexHull *hull;
+    Mat4f R;
+    Vec3f pos;
+
+    // local index of the vertex farthest along the world direction d
+    int supportIndex(const Vec3f &d) const
+    {
+        // (R p) . d = p . (R^T d)
+        Vec3f local(R(0, 0) * d.x + R(1, 0) * d.y + R(2, 0) * d.z, R(0, 1) * d.x + R(1, 1) * d.y + R(2, 1) * d.z,
+                    R(0, 2) * d.x + R(1, 2) * d.y + R(2, 2) * d.z);
+        return hull->support(local);
+    }
+
+    Vec3f vertex(int i) const
+    {
+        const Vec3f &p = hull->vertices[i];
+        return Vec3f(R(0, 0) * p.x + R(0, 1) * p.y + R(0, 2) * p.z, R(1, 0) * p.x + R(1, 1) * p.y + R(1, 2) * p.z,
+                     R(2, 0) * p.x + R(2, 1) * p.y + R(2, 2) * p.z) +
+               pos;
+    }
+
+    Vec3f support(const Vec3f &d) const { return vertex(supportIndex(d)); }
+};
+
+// point of the Minkowski difference a - b farthest along d
+inline Vec3f minkowskiSupport(const ConvexShape &a, const ConvexShape &b, const Vec3f &d)
+{
+    return a.support(d) - b.support(-d);
+}
+
+// GJK: whether two convex shapes overlap. On overlap simplex holds a
+// tetrahedron of a - b around the origin, which epa() starts from.
+bool gjk(const ConvexShape &a, const ConvexShape &b, std::array<Vec3f, 4> &simplex)
+{
+    Vec3f d = a.pos - b.pos;
+    if (d.magSqr() < 1e-12f)
+        d = Vec3f(1, 0, 0);
+    int n = 0;
+    simplex[n++] = minkowskiSupport(a, b, d);
+    d = -simplex[0];
+    for (int iteration = 0; iteration < 64; iteration++)
+    {
+        if (d.magSqr() < 1e-20f)
+            d = Vec3f(0, 1, 0); // the origin is on the simplex; any direction grows it
+        Vec3f p = minkowskiSupport(a, b, d);
+        if (p.dot(d) < 0)
+            return false; // nothing of a - b gets past the origin along d
+        simplex[n++] = p;
+
+        // keep the feature of the simplex nearest the origin and aim d at it;
+        // the newest point is always last
+        auto line = [&](Vec3f A, Vec3f B) {
+            Vec3f AB = B - A, AO = -A;
+            if (AB.dot(AO) > 0)
+            {
+                simplex[0] = B;
+                simplex[1] = A;
+                n = 2;
+                d = AB.cross(AO).cross(AB);
+            }
+            else
+            {
+                simplex[0] = A;
+                n = 1;
+                d = AO;
+            }
+        };
+        if (n == 2)
+            line(simplex[1], simplex[0]);
+        else if (n == 3)
+        {
+            Vec3f A = simplex[2], B = simplex[1], C = simplex[0];
+            Vec3f AB = B - A, AC = C - A, AO = -A;
+            Vec3f ABC = AB.cross(AC);
+            if (ABC.cross(AC).dot(AO) > 0)
+            {
+                if (AC.dot(AO) > 0)
+                {
+                    simplex[0] = C;
+                    simplex[1] = A;
+                    n = 2;
+                    d = AC.cross(AO).cross(AC);
+                }
+                else
+                    line(A, B);
+            }
+            else if (AB.cross(ABC).dot(AO) > 0)
+                line(A, B);
+            else if (ABC.dot(AO) > 0)
+                d = ABC;
+            else
+            {
+                // below the triangle: flip it so the origin is in front
+                simplex[0] = B;
+                simplex[1] = C;
+                d = -ABC;
+            }
+        }
+        else
+        {
+            Vec3f A = simplex[3], B = simplex[2], C = simplex[1], D = simplex[0];
+            Vec3f AB = B - A, AC = C - A, AD = D - A, AO = -A;
+            Vec3f ABC = AB.cross(AC), ACD = AC.cross(AD), ADB = AD.cross(AB);
+            // the triangle faces point away from the fourth vertex
+            if (ABC.dot(AD) > 0)
+                ABC = -ABC;
+            if (ACD.dot(AB) > 0)
+                ACD = -ACD;
+            if (ADB.dot(AC) > 0)
+                ADB = -ADB;
+            // drop the vertex opposite the face the origin is in front of,
+            // then let the triangle case handle it on the next support
+            if (ABC.dot(AO) > 0)
+            {
+                simplex[0] = C;
+                simplex[1] = B;
+                simplex[2] = A;
+                n = 3;
+                d = ABC;
+            }
+            else if (ACD.dot(AO) > 0)
+            {
+                simplex[0] = D;
+                simplex[1] = C;
+                simplex[2] = A;
+                n = 3;
+                d = ACD;
+            }
+            else if (ADB.dot(AO) > 0)
+            {
+                simplex[0] = B;
+                simplex[1] = D;
+                simplex[2] = A;
+                n = 3;
+                d = ADB;
+            }
+            else
+                return true; // the origin is inside all four faces
+        }
+    }
+    return false;
+}
+
+// EPA: grows the GJK tetrahedron inside a - b towards the face of a - b
+// nearest the origin. normal is the unit direction from a towards b along
+// which they overlap by depth; moving a by -normal * depth separates them.
+bool epa(const ConvexShape &a, const ConvexShape &b, const std::array<Vec3f, 4> &simplex, Vec3f &normal,
+         float &depth)
+{
+    struct Face
+    {
+        int v[3];
+        Vec3f n;
+        float d;
+    };
+    std::vector<Vec3f> points(simplex.begin(), simplex.end());
+    std::vector<Face> faces;
+    auto addFace = [&](int i, int j, int k) {
+        Face f = {{i, j, k}};
+        f.n = (points[j] - points[i]).cross(points[k] - points[i]);
+        float mag = f.n.mag();
+        if (mag < 1e-12f)
+            return;
+        f.n /= mag;
+        f.d = f.n.dot(points[i]);
+        if (f.d < 0)
+        {
+            // wound inwards
+            std::swap(f.v[1], f.v[2]);
+            f.n = -f.n;
+            f.d = -f.d;
+        }
+        faces.push_back(f);
+    };
+    addFace(0, 1, 2);
+    addFace(0, 3, 1);
+    addFace(0, 2, 3);
+    addFace(1, 3, 2);
+
+    std::vector<std::pair<int, int>> edges;
+    for (int iteration = 0; iteration < 64 && !faces.empty(); iteration++)
+    {
+        int nearest = 0;
+        for (int f = 1; f < faces.size(); f++)
+        {
+            if (faces[f].d < faces[nearest].d)
+                nearest = f;
+        }
+        normal = faces[nearest].n;
+        depth = faces[nearest].d;
+        Vec3f p = minkowskiSupport(a, b, normal);
+        if (p.dot(normal) - depth < 1e-4f * (1 + depth))
+            return true; // the face is on the boundary of a - b
+
+        // remove the faces p sees, keep their outline, close it with p
+        int index = points.size();
+        points.push_back(p);
+        edges.clear();
+        for (int f = 0; f < faces.size();)
+        {
+            if (faces[f].n.dot(p - points[faces[f].v[0]]) > 0)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    std::pair<int, int> e(faces[f].v[k], faces[f].v[(k + 1) % 3]);
+                    auto reverse = std::find(edges.begin(), edges.end(), std::make_pair(e.second, e.first));
+                    if (reverse != edges.end())
+                        edges.erase(reverse);
+                    else
+                        edges.push_back(e);
+                }
+                faces[f] = faces.back();
+                faces.pop_back();
+            }
+            else
+                f++;
+        }
+        for (auto &e : edges)
+            addFace(e.first, e.second, index);
+    }
+    return !faces.empty();
+}
@@ -10,6 +10,10 @@
 #include "al/graphics/al_Image.hpp"
 #include "object.hpp"
 #include "physicsObject.hpp"
+#include "fixedTimestep.hpp"
+#include "physicsThread.hpp"
+#include "physicsWorld.hpp"
+#include "aabbTree.hpp"
 #include "skybox.hpp"
 #include "al/app/al_DistributedApp.hpp"
 #include "al/io/al_Imgui.hpp"
@@ -20,11 +24,23 @@ using namespace al;
 struct MyApp : DistributedApp
 {
   std::vector<std::shared_ptr<RigidObject>> bunnys;
+  PhysicsWorld world;
+  FixedTimestep timestep; // renderers step their cloths themselves
+  // On the primary the world, scene tree and cloth simulation belong to the
+  // physics thread once it runs: input reaches them through physics.post and
+  // drawing reads the snapshots it publishes.
+  PhysicsThread physics;
+  const PhysicsSnapshot *snapshot = nullptr; // this frame's
+  std::vector<Pose> drawPoses;
+  std::vector<Vec3f> drawVertices;
+  AABBTree sceneTree; // every object, tagged with its bunny index or -1
+  std::vector<int> sceneProxies;
+  std::vector<Vec3f> sceneCenters;
   std::unique_ptr<V1Object> plane;
   std::unique_ptr<Skybox> skybox;
   std::shared_ptr<MassSpring> cloth1;
   std::shared_ptr<MassSpring> cloth2;
-  int nearOne = -1;
+  std::atomic<int> nearOne{-1};
   float nearT = 9999;
   int axis = -1;
 
@@ -36,7 +52,7 @@ struct MyApp : DistributedApp
   float dragFactor = 0.05f;
 
   // for networking
-  std::vector<ParameterPose> poses;
+  std::vector<std::unique_ptr<ParameterPose>> poses;
   std::vector<ParameterVec3> cloth1Pos;
   std::vector<ParameterVec3> cloth2Pos;
   ParameterBool showOctree{"showOctree", "", true};
@@ -46,6 +62,7 @@ struct MyApp : DistributedApp
   ParameterDouble dragFactor{"dragFactor", "", 0.05f};*/
   ParameterVec4 para4{"para4", "", Vec4f(30.0, 0.75 * M_2PI, 0.125 * M_2PI, 0.05f)};
   ParameterInt bunnyNum{"bunnyNum", "", 0};
+  Parameter physicsStep{"physicsStep", "", 0.016f, 0.008f, 0.033f}; // renderers step their cloths at it too
 
   void createCloth()
   {
@@ -56,8 +73,10 @@ struct MyApp : DistributedApp
     cloth1->scale = Vec3f(0.9f);
     cloth1->reCalculateL();
     cloth1->nav.pos(0, 8, 0);
+    cloth1->colliders = &world.colliders;
     cloth1->material.shininess(128);
     cloth1->singleLight.pos(5, 10, -5);
+    addToScene(cloth1.get(), -1);
     /*for (int i = 0; i < cloth1->mesh.vertices().size(); i++)
     {
       cloth1Pos.push_back(ParameterVec3("cloth1_" + std::to_string(i)));
@@ -73,8 +92,10 @@ struct MyApp : DistributedApp
     cloth2->scale = Vec3f(0.9f);
     cloth2->reCalculateL();
     cloth2->nav.pos(0, 8, -8);
+    cloth2->colliders = &world.colliders;
     cloth2->material.shininess(128);
     cloth2->singleLight.pos(5, 10, -5);
+    addToScene(cloth2.get(), -1);
 
     /*for (int i = 0; i < cloth2->mesh.vertices().size(); i++)
     {
@@ -88,28 +109,62 @@ struct MyApp : DistributedApp
 
   void createBunny()
   {
-  if (bunnys.size() >= 20) return;
-    std::shared_ptr<RigidObject> bunny = std::make_shared<RigidObject>(
-        "./assets/bunny/bunny.obj",
-        "./shaders/default",
-        "./assets/bunny/bunny-atlas.jpg");
-
-    bunny->onCreate();
-    bunny->generateNormals();
-    bunny->scale = Vec3f(0.005);
-    bunny->nav.pos(1, 4, 1);
-    bunny->nav.quat().fromAxisAngle(-0.5 * M_2PI, 1, 0, 0);
-    bunny->material.shininess(8.0f);
-    bunny->singleLight.pos(5, 10, -5);
-    bunny->createAABBAndOctree();
-    bunny->initIRef();
-    bunnys.push_back(bunny);
+    createBunnys(1);
+  }
+
+  // octrees of the whole batch are built in parallel
+  void createBunnys(int num)
+  {
+    std::vector<std::shared_ptr<RigidObject>> batch;
+    while (batch.size() < num)
+    {
+      std::shared_ptr<RigidObject> bunny = std::make_shared<RigidObject>(
+          "./assets/bunny/bunny.obj",
+          "./shaders/default",
+          "./assets/bunny/bunny-atlas.jpg");
+
+      bunny->onCreate();
+      if (!bunny->asset->normalsGenerated)
+        bunny->generateNormals();
+      bunny->scale = Vec3f(0.005);
+      bunny->nav.pos(1, 4, 1);
+      bunny->nav.quat().fromAxisAngle(-0.5 * M_2PI, 1, 0, 0);
+      bunny->material.shininess(8.0f);
+      bunny->singleLight.pos(5, 10, -5);
+      batch.push_back(bunny);
+    }
+    createAABBAndOctrees(batch);
+    for (auto &bunny : batch)
+    {
+      bunnys.push_back(bunny);
+      poses.push_back(std::make_unique<ParameterPose>("bunnys_" + std::to_string(bunnys.size() - 1)));
+      parameterServer() << *poses.back();
+    }
+    auto addBodies = [this, batch]() {
+      for (auto &bunny : batch)
+      {
+        world.addBody(bunny);
+        addToScene(bunny.get(), world.bodies.size() - 1);
+      }
+    };
+    if (physics.running())
+      physics.post(addBodies);
+    else
+      addBodies();
     if (isPrimary())
     {
       bunnyNum = bunnys.size();
     }
-    //poses.push_back(ParameterPose("bunnys_" + std::to_string(bunnys.size() - 1)));
-    //parameterServer() << poses[bunnys.size() - 1];
+  }
+
+  // the floor and the four walls every body and cloth collides with
+  void createRoom()
+  {
+    world.colliders.addPlane(Vec3f(0, -1.5f, 0), Vec3f(0, 1, 0));
+    world.colliders.addPlane(Vec3f(15.0f, 0, 0), Vec3f(-1, 0, 0));
+    world.colliders.addPlane(Vec3f(-15.0f, 0, 0), Vec3f(1, 0, 0));
+    world.colliders.addPlane(Vec3f(0, 0, 15.0f), Vec3f(0, 0, -1));
+    world.colliders.addPlane(Vec3f(0, 0, -15.0f), Vec3f(0, 0, 1));
   }
 
   void createPlane()
@@ -123,6 +178,40 @@ struct MyApp : DistributedApp
     plane->nav.quat().fromAxisAngle(-0.25 * M_2PI, 1, 0, 0);
     plane->material.shininess(32);
     plane->singleLight.pos(5, 10, -5);
+    addToScene(plane.get(), -1);
+  }
+
+  void addToScene(Object *object, int tag)
+  {
+    Vec3f min, max;
+    object->worldAABB(min, max);
+    sceneProxies.push_back(sceneTree.createProxy(min, max, object, tag));
+    sceneCenters.push_back((min + max) * 0.5f);
+  }
+
+  // refit the scene tree to where the objects are now
+  void updateScene()
+  {
+    for (int i = 0; i < sceneProxies.size(); i++)
+    {
+      Vec3f min, max;
+      sceneTree.object(sceneProxies[i])->worldAABB(min, max);
+      Vec3f center = (min + max) * 0.5f;
+      sceneTree.moveProxy(sceneProxies[i], min, max, center - sceneCenters[i]);
+      sceneCenters[i] = center;
+    }
+  }
+
+  // only the bunnys near the cloth
+  void collideCloth(MassSpring &cloth, float dt)
+  {
+    Vec3f min, max;
+    cloth.worldAABB(min, max);
+    sceneTree.query(min, max, [&](int proxy) {
+      int i = sceneTree.tag(proxy);
+      if (i >= 0)
+        cloth.rigidBodyCollision(*world.bodies[i], dt);
+    });
   }
 
   void createSkybox()
@@ -140,6 +229,7 @@ struct MyApp : DistributedApp
 
   void onCreate() override
   {
+    createRoom();
     createBunny();
     createCloth();
     createPlane();
@@ -153,13 +243,41 @@ struct MyApp : DistributedApp
     euler.z = 0;
     nav().quat().fromEuler(euler);
     navControl().disable();
-    parameterServer() << showOctree << para4 << bunnyNum;
-    for (int i = 0; i < 20; i++) {
-      poses.push_back(ParameterPose("bunnys_" + std::to_string(i)));
-    }
-    for (int i = 0; i < 20; i++) {
-      parameterServer() << poses[i];
-    }
+    parameterServer() << showOctree << para4 << bunnyNum << physicsStep;
+    if (isPrimary())
+      startPhysics();
+  }
+
+  void startPhysics()
+  {
+    physics.step = [this](float dt) {
+      world.step(dt);
+      updateScene();
+      cloth1->onAnimate(dt);
+      collideCloth(*cloth1, dt);
+      cloth2->onAnimate(dt);
+      collideCloth(*cloth2, dt);
+    };
+    physics.publish = [this](PhysicsSnapshot &s) {
+      s.lastPos = world.lastPos;
+      s.lastQuat = world.lastQuat;
+      s.pos.resize(world.bodies.size());
+      s.quat.resize(world.bodies.size());
+      for (int i = 0; i < world.bodies.size(); i++)
+      {
+        s.pos[i] = world.state.position(i);
+        s.quat[i] = world.state.orientation(i);
+      }
+      s.lastCloth.resize(2);
+      s.cloth.resize(2);
+      s.lastCloth[0] = cloth1->lastVertices;
+      s.cloth[0] = cloth1->mesh.vertices();
+      s.lastCloth[1] = cloth2->lastVertices;
+      s.cloth[1] = cloth2->mesh.vertices();
+      s.clothIterations = {cloth1->solver.lastIterations, cloth2->solver.lastIterations};
+      s.clothResiduals = {cloth1->solver.lastResidual, cloth2->solver.lastResidual};
+    };
+    physics.start();
   }
 
   bool onKeyDown(Keyboard const &k) override
@@ -171,20 +289,24 @@ struct MyApp : DistributedApp
       {
       case ' ':
       {
-        bunnys[nearOne]->addVelocity(Vec3f(0, 100.0f * dragFactor, 0));
+        Vec3f v(0, 100.0f * dragFactor, 0);
+        physics.post([this, v]() {
+          if (nearOne >= 0)
+            world.bodies[nearOne]->addVelocity(v);
+        });
       }
       break;
       }
     }
     return true;
   }
-  void onAnimate(double dt) override
+  void onAnimate(double frameDt) override
   {
-    dt = 0.016f;
-    if (dt < 1e-6)
-      return;
     if (!isPrimary())
     {
+      timestep.step = physicsStep.get();
+      int steps = timestep.advance(frameDt);
+      float dt = timestep.step;
       auto _para4 = para4.get();
       viewDistance = _para4.x;
       theta1 = _para4.y;
@@ -192,22 +314,23 @@ struct MyApp : DistributedApp
       dragFactor = _para4.w;
       for (int i = 0; i < bunnys.size(); i++)
       {
-        bunnys[i]->nav.set(poses[i].get());
-      }
-      cloth1->onAnimate(dt);
-      for (int i = 0; i < bunnys.size(); i++)
-      {
-        cloth1->rigidBodyCollision(*bunnys[i], dt);
+        bunnys[i]->nav.set(poses[i]->get());
+        bunnys[i]->updateTransform();
       }
-      cloth2->onAnimate(dt);
-      for (int i = 0; i < bunnys.size(); i++)
+      updateScene();
+      for (int i = 0; i < steps; i++)
       {
-        cloth2->rigidBodyCollision(*bunnys[i], dt);
+        cloth1->onAnimate(dt);
+        collideCloth(*cloth1, dt);
+        cloth2->onAnimate(dt);
+        collideCloth(*cloth2, dt);
       }
+      cloth1->interpolate(timestep.alpha());
+      cloth2->interpolate(timestep.alpha());
 
-      while (bunnyNum > bunnys.size())
+      if (bunnyNum > bunnys.size())
       {
-        createBunny();
+        createBunnys(bunnyNum - bunnys.size());
       }
       nav().pos(viewDistance * sinf(theta1),
                 viewDistance * sinf(theta2),
@@ -234,34 +357,21 @@ struct MyApp : DistributedApp
       cloth2->reBindVertices();*/
       return;
     }
-    for (int i = 0; i < bunnys.size(); i++)
+    // draw between the last two published steps
+    snapshot = &physics.latest();
+    float alpha = snapshot->alpha(PhysicsThread::now());
+    drawPoses.resize(std::min<int>(snapshot->bodies(), bunnys.size()));
+    for (int i = 0; i < drawPoses.size(); i++)
     {
-      for (int j = 0; j < bunnys.size(); j++)
-      {
-        if (i == j)
-          continue;
-        bunnys[i]->rigidBodyCollision(*bunnys[j]);
-      }
+      drawPoses[i] = snapshot->pose(i, alpha);
+      *poses[i] = drawPoses[i].pos();
     }
-
-    for (int i = 0; i < bunnys.size(); i++)
+    if (snapshot->cloth.size() == 2)
     {
-      bunnys[i]->onAnimate(dt);
-    }
-    cloth1->onAnimate(dt);
-    for (int i = 0; i < bunnys.size(); i++)
-    {
-      cloth1->rigidBodyCollision(*bunnys[i], dt);
-    }
-    cloth2->onAnimate(dt);
-    for (int i = 0; i < bunnys.size(); i++)
-    {
-      cloth2->rigidBodyCollision(*bunnys[i], dt);
-    }
-
-    for (int i = 0; i < bunnys.size(); i++)
-    {
-      poses[i] = bunnys[i]->nav.pos();
+      snapshot->clothVertices(0, alpha, drawVertices);
+      cloth1->upload(drawVertices);
+      snapshot->clothVertices(1, alpha, drawVertices);
+      cloth2->upload(drawVertices);
     }
     
     para4 = Vec4f(viewDistance, theta1, theta2, dragFactor);
@@ -285,15 +395,18 @@ struct MyApp : DistributedApp
     skybox->onDraw(g, nav());
     g.popMatrix();
 
-    for (int i = 0; i < bunnys.size(); i++)
+    // the primary draws the physics snapshot, renderers the received poses
+    int drawn = isPrimary() ? drawPoses.size() : bunnys.size();
+    for (int i = 0; i < drawn; i++)
     {
+      const Pose &pose = isPrimary() ? drawPoses[i] : bunnys[i]->nav;
       g.pushMatrix();
-      bunnys[i]->onDraw(g, nav());
+      bunnys[i]->drawAt(g, nav(), pose);
       g.popMatrix();
       if (showOctree.get() || i == nearOne)
       {
         g.pushMatrix();
-        bunnys[i]->drawAABB(g, nav());
+        bunnys[i]->drawAABB(g, nav(), pose);
         g.popMatrix();
       }
     }
@@ -340,6 +453,26 @@ struct MyApp : DistributedApp
     }
     viewDistance = _dis;
 
+    // larger steps cost less per simulated second, for loaded machines
+    static float _step = 0.016f;
+    if (ImGui::SliderFloat("Physics Step", &_step, 0.008f, 0.033f, "%.3f s"))
+    {
+      float step = _step;
+      physicsStep = step;
+      physics.post([this, step]() { physics.timestep.step = step; });
+    }
+
+    // Projective Dynamics for the cloths instead of Jacobi iterations
+    static bool _projective = false;
+    if (ImGui::Checkbox("Projective Cloth", &_projective))
+    {
+      bool projective = _projective;
+      physics.post([this, projective]() {
+        cloth1->solver.projective = projective;
+        cloth2->solver.projective = projective;
+      });
+    }
+
     static float _drag = 0.05f;
     ImGui::SliderFloat("Drag Factor", &_drag, 0.01f, 0.2f, "ratio = %.3f");
     dragFactor = _drag;
@@ -351,6 +484,19 @@ struct MyApp : DistributedApp
       {
       }
     }
+    ImGui::SameLine();
+    if (ImGui::Button("Add 10 Bunnys"))
+    {
+      createBunnys(10);
+    }
+
+    // iterations the cloth solver needed, fewer at rest
+    if (snapshot && snapshot->clothIterations.size() == 2)
+    {
+      for (int c = 0; c < 2; c++)
+        ImGui::Text("Cloth %d: %d iterations, residual %.4f m/s", c + 1, snapshot->clothIterations[c],
+                    snapshot->clothResiduals[c]);
+    }
     ImGui::End();
     imguiEndFrame();
     imguiDraw();
@@ -363,6 +509,7 @@ struct MyApp : DistributedApp
     }
   }
   void onExit() override { 
+    physics.stop();
     if (isPrimary())
       imguiShutdown(); 
   }
@@ -398,18 +545,28 @@ struct MyApp : DistributedApp
   {
     if (!isPrimary()) return true;
     Rayd r = getPickRay(m.x(), m.y());
+    // picked on the physics thread, which owns the scene tree
+    physics.post([this, r]() { pick(r); });
+    return true;
+  }
+
+  void pick(Rayd r)
+  {
     nearOne = -1;
     nearT = 9999;
-    for (int i = 0; i < bunnys.size(); i++)
-    {
+    // the scene tree hands over the bunnys whose boxes the ray crosses
+    sceneTree.rayCast(Vec3f(r.origin()), Vec3f(r.direction()), nearT, [&](int proxy, float) {
+      int i = sceneTree.tag(proxy);
+      if (i < 0)
+        return nearT;
+      auto &bunny = *world.bodies[i];
       Mat4f R;
-      Mat4f S = ScaleMatrix(bunnys[i]->scale);
-      bunnys[i]->nav.quat().toMatrix(R.elems());
+      Mat4f S = ScaleMatrix(bunny.scale);
+      bunny.nav.quat().toMatrix(R.elems());
       R = S * R;
-      auto inversedR = R.inversed();
-      Vec3f x = bunnys[i]->nav.pos();
+      Vec3f x = bunny.nav.pos();
 
-      float radius = Vec3f(R * Vec4f(bunnys[i]->AABBAverageLength, 1.0f)).mag();
+      float radius = Vec3f(R * Vec4f(bunny.AABBAverageLength, 1.0f)).mag();
       float t = r.intersectSphere(x, radius * 0.8f);
       // std::cout << "center" << x << "scl" << radius * 0.8f << "t" << t << std::endl;
       if (t > 0 && t < nearT)
@@ -418,15 +575,17 @@ struct MyApp : DistributedApp
         nearOne = i;
         dragDir = r.direction().cross(Vec3f(0, 1, 0)).normalize();
       }
-    }
-    return true;
+      return nearT;
+    });
   }
 
   bool onMouseUp(const Mouse &m) override
   {
     if (!isPrimary()) return true;
-    nearOne = -1;
-    nearT = 9999;
+    physics.post([this]() {
+      nearOne = -1;
+      nearT = 9999;
+    });
     return true;
   }
 
@@ -451,9 +610,13 @@ struct MyApp : DistributedApp
     {
       float dx = m.dx() * dragFactor;
       float dy = -m.dy() * dragFactor;
-      Vec3f axisDir = dragDir.cross(Vec3f(0, 1, 0)).normalize();
-      auto result = dragDir * dx - axisDir * dy;
-      bunnys[nearOne]->addVelocity(result);
+      physics.post([this, dx, dy]() {
+        if (nearOne < 0)
+          return;
+        Vec3f axisDir = dragDir.cross(Vec3f(0, 1, 0)).normalize();
+        auto result = dragDir * dx - axisDir * dy;
+        world.bodies[nearOne]->addVelocity(result);
+      });
     }
 
     return true;
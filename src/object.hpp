@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -11,6 +12,7 @@
 #include "al/graphics/al_DefaultShaderString.hpp"
 #include "al/graphics/al_BufferObject.hpp"
 #include "al/graphics/al_Graphics.hpp"
+#include "asset.hpp"
 #include "loader.hpp"
 #include "math_helper.hpp"
 
@@ -20,50 +22,21 @@ class Object
 public:
     Nav nav;
     Vec3f scale;
-    Mesh mesh;
-    Texture texture;
     Material material;
-    ShaderProgram shader;
 
     // multiObject may use the same source, reduce memory costing
-    
+    std::shared_ptr<ObjectAsset> asset;
+    Mesh &mesh;
+    Texture &texture;
+    ShaderProgram &shader;
+
 public:
     Object(const std::string meshPath = "", const std::string shaderPath = "", 
-        const std::string texPath = "") {
-        if (!strcmp(meshPath.c_str(), "")) {
-            addSphere(mesh);
-        } else {
-            std::vector<Vec3f> vertices;
-            std::vector<Vec2f> uvs;
-            std::vector<Vec3f> normals;
-            loadOBJ(meshPath.c_str(), vertices, uvs, normals);
-            indexVBO(vertices, uvs, normals, mesh.indices(), mesh.vertices(), mesh.texCoord2s(), mesh.normals());
-        }
+        const std::string texPath = "") 
+        : Object(loadObjectAsset(meshPath, shaderPath, texPath)) {}
 
-        if (!strcmp(shaderPath.c_str(), "")) {
-            al::ShaderSources un = al::defaultShaderUniformColor(false, false, false);
-            shader.compile(un.vert.c_str(), un.frag.c_str());
-        } else {
-            std::fstream vert(std::string(shaderPath + ".vert").c_str(), std::ios::in);
-            std::fstream frag(std::string(shaderPath + ".frag").c_str(), std::ios::in);
-            std::stringstream vertStr;
-            std::stringstream fragStr;
-            if (!vert.good() || !frag.good()) {
-                std::cout<<"ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
-            }
-            vertStr << vert.rdbuf();
-            fragStr << frag.rdbuf();
-            if (!shader.compile(vertStr.str().c_str(), fragStr.str().c_str())) {
-                std::cout<<"ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
-            }
-            vert.close();
-            frag.close();
-        }
-        if (!strcmp(texPath.c_str(), "")) {
-            // pass
-        } else {
-            loadTexture(texture, texPath);
-        }
+    Object(std::shared_ptr<ObjectAsset> _asset)
+        : asset(_asset), mesh(_asset->mesh), texture(_asset->texture), shader(_asset->shader) {
         // default material
         material.ambient(Color(1.0f, 1.0f, 1.0f, 1.0f));
         material.diffuse(Color(1.0f, 1.0f, 1.0f, 1.0f));
@@ -77,6 +50,24 @@ public:
     virtual void onCreate() = 0;
     virtual void onAnimate(double dt) = 0;
     virtual void onDraw(Graphics& g, Nav& camera) = 0;
+
+    // world space bounds of the transformed mesh, for the scene tree
+    virtual void worldAABB(Vec3f &min, Vec3f &max) {
+        Mat4f R;
+        Mat4f S = ScaleMatrix(scale);
+        nav.quat().toMatrix(R.elems());
+        R = S * R;
+        Vec3f x = nav.pos();
+        min = Vec3f(9999, 9999, 9999);
+        max = Vec3f(-9999, -9999, -9999);
+        for (auto &vert : mesh.vertices()) {
+            Vec3f p = Vec3f(R * Vec4f(vert, 1.0f)) + x;
+            for (int i = 0; i < 3; i++) {
+                min[i] = std::min(min[i], p[i]);
+                max[i] = std::max(max[i], p[i]);
+            }
+        }
+    }
 };
 
 class V1Object : public Object 
@@ -84,12 +75,16 @@ class V1Object : public Object
 public:
     Light singleLight;
 
-    BufferObject bufferArray[3];
-    BufferObject elementBuffer;
-    VAO vao;
+    BufferObject (&bufferArray)[3];
+    BufferObject &elementBuffer;
+    VAO &vao;
     V1Object(const std::string meshPath = "", const std::string shaderPath = "./shaders/default", 
         const std::string texPath = "") 
-        : Object(meshPath, shaderPath, texPath) {}
+        : V1Object(loadObjectAsset(meshPath, shaderPath, texPath)) {}
+
+    V1Object(std::shared_ptr<ObjectAsset> _asset)
+        : Object(_asset), bufferArray(_asset->bufferArray), elementBuffer(_asset->elementBuffer), 
+        vao(_asset->vao) {}
 
     void onCreate() override {
         Color lightColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -97,7 +92,9 @@ public:
         singleLight.diffuse(lightColor * 0.7f);
         singleLight.specular(Color(1.0f, 1.0f, 1.0f, 1.0f));
 
-        
+        // buffers are shared, only the first instance uploads them
+        if (asset->uploaded) return;
+        asset->uploaded = true;
         std::vector<int>bufferSize({3, 2, 3});
         vao.create();
         for (int i = 0; i < bufferSize.size(); i++) {
@@ -128,10 +125,15 @@ public:
     }
 
     void onDraw(Graphics& g, Nav& camera) override {
+        drawAt(g, camera, nav);
+    }
+
+    // drawn at pose instead of nav, e.g. a snapshot of another thread's state
+    void drawAt(Graphics& g, Nav& camera, const Pose& pose) {
         shader.use();
 
-        g.translate(nav.pos());
-        g.rotate(nav.quat());
+        g.translate(pose.pos());
+        g.rotate(pose.quat());
         g.scale(scale);
         
 
@@ -171,6 +173,7 @@ public:
     }
 
     void generateNormals() {
+        asset->normalsGenerated = true;
         mesh.generateNormals();
         bufferArray[2].bind();
         bufferArray[2].data(mesh.normals().size() * sizeof(float) * 3, mesh.normals().data());
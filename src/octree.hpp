@@ -1,7 +1,16 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
 #include "al/graphics/al_Mesh.hpp"
+#include "math_helper.hpp"
+#include "threadPool.hpp"
 
 using namespace al;
 struct OctreeNode
@@ -83,7 +92,7 @@ void createMeshOctree(OctreeNode *root, Mesh &mesh, float xmin, float xmax,
             return;
         float xm = (xmax - xmin) / 2;
         float ym = (ymax - ymin) / 2;
-        float zm = (ymax - ymin) / 2;
+        float zm = (zmax - zmin) / 2;
         for (int i = 0; i < 8; i++)
         {
             root->children[i] = new OctreeNode();
@@ -160,4 +169,605 @@ int depth(OctreeNode *root)
         maxDepth = max(depth(root->children[i]), maxDepth);
     }
     return maxDepth;
-}
\ No newline at end of file
+}
+
+// Linear octree: every node lives in one contiguous array, level by level.
+// Inside a level the nodes are in Morton order, and the occupied children of a
+// node are stored next to each other, so a child is found from firstChild and
+// the popcount of childMask. Node bounds are not stored, they are decoded from
+// the Morton code and the root box.
+struct LinearOctreeNode
+{
+    uint64_t code;       // Morton code of the cell at its depth (bit0 x, bit1 y, bit2 z)
+    uint32_t count;      // number of vertices inside the cell
+    uint32_t firstChild; // index of the first occupied child
+    uint8_t childMask;   // bit i set if child i is occupied
+    uint8_t depth;       // root is depth 1, like OctreeNode
+};
+
+struct LinearOctree
+{
+    Vec3f min, max;
+    int maxDepth = 0;
+    std::vector<LinearOctreeNode> nodes;
+    std::vector<uint32_t> levelStart; // nodes of depth d are in [levelStart[d - 1], levelStart[d])
+    // up to gridMaxDepth: the leaf of every cell at maxDepth (x fastest, -1
+    // if empty) and the center of every leaf, for collideLinearOctrees
+    static const int gridMaxDepth = 6;
+    std::vector<int32_t> leafGrid;
+    std::vector<Vec3f> leafCenters;
+
+    void clear()
+    {
+        nodes.clear();
+        levelStart.clear();
+        leafGrid.clear();
+        leafCenters.clear();
+        maxDepth = 0;
+    }
+
+    bool isLeaf(const LinearOctreeNode &node) const
+    {
+        return node.childMask == 0;
+    }
+
+    int child(const LinearOctreeNode &node, int i) const
+    {
+        if (!(node.childMask & (1 << i)))
+            return -1;
+        return node.firstChild + std::bitset<8>(node.childMask & ((1 << i) - 1)).count();
+    }
+
+    // leaves at maxDepth, the only ones used for collision and drawing
+    uint32_t leafBegin() const
+    {
+        return levels() < maxDepth ? (uint32_t)nodes.size() : levelStart[maxDepth - 1];
+    }
+    uint32_t leafEnd() const { return nodes.size(); }
+    int levels() const { return levelStart.empty() ? 0 : (int)levelStart.size() - 1; }
+
+    Vec3f cellSize(int depth) const
+    {
+        return (max - min) * (1.0f / (1 << (depth - 1)));
+    }
+
+    void nodeBounds(const LinearOctreeNode &node, Vec3f &nodeMin, Vec3f &nodeMax) const
+    {
+        uint32_t x = 0, y = 0, z = 0;
+        for (int bit = 0; bit < node.depth - 1; bit++)
+        {
+            x |= ((node.code >> (bit * 3 + 0)) & 1) << bit;
+            y |= ((node.code >> (bit * 3 + 1)) & 1) << bit;
+            z |= ((node.code >> (bit * 3 + 2)) & 1) << bit;
+        }
+        Vec3f size = cellSize(node.depth);
+        nodeMin = min + Vec3f(x * size.x, y * size.y, z * size.z);
+        nodeMax = nodeMin + size;
+    }
+
+    Vec3f nodeCenter(const LinearOctreeNode &node) const
+    {
+        Vec3f nodeMin, nodeMax;
+        nodeBounds(node, nodeMin, nodeMax);
+        return (nodeMin + nodeMax) / 2;
+    }
+
+    size_t memoryBytes() const
+    {
+        return sizeof(LinearOctree) + nodes.capacity() * sizeof(LinearOctreeNode) +
+               levelStart.capacity() * sizeof(uint32_t) + leafGrid.capacity() * sizeof(int32_t) +
+               leafCenters.capacity() * sizeof(Vec3f);
+    }
+};
+
+// Vertex indices are partitioned in place into the eight children of each
+// node, so every level touches every vertex once: O(vertices * depth).
+// Nodes of a level own disjoint index ranges, so once a level holds more than
+// parallelCutoff vertices its nodes are split as parallel tasks.
+void createLinearOctree(LinearOctree &octree, Mesh &mesh, Vec3f min, Vec3f max, int maxDepth,
+                        size_t parallelCutoff = 16384, ThreadPool &pool = ThreadPool::instance())
+{
+    octree.clear();
+    octree.min = min;
+    octree.max = max;
+    octree.maxDepth = maxDepth;
+    if (maxDepth <= 0)
+        return;
+    // 3 bits per level below the root
+    if (maxDepth > 22)
+    {
+        std::cout << "linear octree: depth " << maxDepth << " clamped to 22" << std::endl;
+        octree.maxDepth = maxDepth = 22;
+    }
+
+    auto &vertices = mesh.vertices();
+    std::vector<uint32_t> index;
+    index.reserve(vertices.size());
+    for (uint32_t i = 0; i < vertices.size(); i++)
+    {
+        auto &vert = vertices[i];
+        if (vert.x >= min.x && vert.x <= max.x &&
+            vert.y >= min.y && vert.y <= max.y &&
+            vert.z >= min.z && vert.z <= max.z)
+            index.push_back(i);
+    }
+
+    // first vertex of every node of the level being split, and of the next one
+    std::vector<uint32_t> rangeBegin(1, 0);
+    std::vector<uint32_t> nextRangeBegin;
+    // split[c] .. split[c + 1] is the index range of child c
+    std::vector<std::array<uint32_t, 9>> splits;
+    auto splitNode = [&](uint32_t i, std::array<uint32_t, 9> &split) {
+        const LinearOctreeNode &node = octree.nodes[i];
+        Vec3f nodeMin, nodeMax;
+        octree.nodeBounds(node, nodeMin, nodeMax);
+        Vec3f center = (nodeMin + nodeMax) / 2;
+
+        // z first, then y, then x gives the Morton child order
+        auto begin = index.begin();
+        split[0] = rangeBegin[i - octree.levelStart[node.depth - 1]];
+        split[8] = split[0] + node.count;
+        split[4] = std::partition(begin + split[0], begin + split[8], [&](uint32_t v) { return vertices[v].z < center.z; }) - begin;
+        for (int h = 0; h < 8; h += 4)
+        {
+            split[h + 2] = std::partition(begin + split[h], begin + split[h + 4], [&](uint32_t v) { return vertices[v].y < center.y; }) - begin;
+        }
+        for (int q = 0; q < 8; q += 2)
+        {
+            split[q + 1] = std::partition(begin + split[q], begin + split[q + 2], [&](uint32_t v) { return vertices[v].x < center.x; }) - begin;
+        }
+    };
+
+    octree.levelStart.push_back(0);
+    octree.nodes.push_back(LinearOctreeNode{0, (uint32_t)index.size(), 0, 0, 1});
+    for (int depth = 1; depth <= maxDepth; depth++)
+    {
+        uint32_t begin = octree.levelStart[depth - 1];
+        uint32_t end = octree.nodes.size();
+        octree.levelStart.push_back(end);
+        if (depth == maxDepth || begin == end)
+            break;
+
+        splits.resize(end - begin);
+        if (index.size() >= parallelCutoff && end - begin > 1)
+        {
+            pool.parallelFor(end - begin, [&](int i) { splitNode(begin + i, splits[i]); });
+        }
+        else
+        {
+            for (uint32_t i = begin; i < end; i++)
+                splitNode(i, splits[i - begin]);
+        }
+
+        nextRangeBegin.clear();
+        for (uint32_t i = begin; i < end; i++)
+        {
+            auto &split = splits[i - begin];
+            uint64_t code = octree.nodes[i].code;
+            octree.nodes[i].firstChild = octree.nodes.size();
+            for (int c = 0; c < 8; c++)
+            {
+                uint32_t count = split[c + 1] - split[c];
+                if (count == 0)
+                    continue;
+                octree.nodes[i].childMask |= 1 << c;
+                octree.nodes.push_back(LinearOctreeNode{(code << 3) | c, count, 0, 0, (uint8_t)(depth + 1)});
+                nextRangeBegin.push_back(split[c]);
+            }
+        }
+        rangeBegin.swap(nextRangeBegin);
+    }
+
+    if (octree.levels() == maxDepth && maxDepth <= LinearOctree::gridMaxDepth)
+    {
+        int n = 1 << (maxDepth - 1);
+        octree.leafGrid.assign(n * n * n, -1);
+        for (uint32_t i = octree.leafBegin(); i < octree.leafEnd(); i++)
+        {
+            uint64_t code = octree.nodes[i].code;
+            int x = 0, y = 0, z = 0;
+            for (int bit = 0; bit < maxDepth - 1; bit++)
+            {
+                x |= ((code >> (bit * 3 + 0)) & 1) << bit;
+                y |= ((code >> (bit * 3 + 1)) & 1) << bit;
+                z |= ((code >> (bit * 3 + 2)) & 1) << bit;
+            }
+            octree.leafGrid[x + (y + z * n) * n] = i;
+            octree.leafCenters.push_back(octree.nodeCenter(octree.nodes[i]));
+        }
+    }
+}
+
+void linearOctreeToMesh(const LinearOctree &octree, Mesh &mesh)
+{
+    for (uint32_t i = octree.leafBegin(); i < octree.leafEnd(); i++)
+    {
+        mesh.vertex(octree.nodeCenter(octree.nodes[i]));
+    }
+}
+
+// Separating axis test between box A (center/half size in its own frame,
+// mapped into B's frame by the affine aToB) and the axis aligned box B.
+// aToB may contain scale, the A axes are then only used as test directions.
+bool boxesOverlap(Vec3f centerA, Vec3f halfA, const Mat4f &aToB, Vec3f centerB, Vec3f halfB)
+{
+    Vec3f u[3]; // edges of box A in B's frame
+    for (int i = 0; i < 3; i++)
+    {
+        u[i] = Vec3f(aToB[i * 4 + 0], aToB[i * 4 + 1], aToB[i * 4 + 2]) * halfA[i];
+    }
+    Vec3f d = Vec3f(aToB * Vec4f(centerA, 1.0f)) - centerB;
+
+    auto separated = [&](Vec3f L) {
+        float rA = fabs(L.dot(u[0])) + fabs(L.dot(u[1])) + fabs(L.dot(u[2]));
+        float rB = halfB.x * fabs(L.x) + halfB.y * fabs(L.y) + halfB.z * fabs(L.z);
+        return fabs(L.dot(d)) > rA + rB;
+    };
+    for (int k = 0; k < 3; k++)
+    {
+        Vec3f e(0);
+        e[k] = 1;
+        if (separated(e))
+            return false;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (separated(u[i]))
+            return false;
+    }
+    for (int k = 0; k < 3; k++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            Vec3f e(0);
+            e[k] = 1;
+            Vec3f L = e.cross(u[i]);
+            if (L.magSqr() > 1e-12f && separated(L))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Buffers of collideLinearOctrees, kept by the caller so a call allocates
+// nothing once they have grown: per depth tables of the node boxes and the
+// stack of node pairs still to visit.
+struct OctreePairScratch
+{
+    struct Entry
+    {
+        uint32_t a, b;
+        Vec3f centerA, centerB; // both in b's frame
+    };
+    std::vector<std::array<Vec3f, 3>> edgeA;
+    std::vector<Vec3f> extentA, halfB;
+    std::vector<float> radiusA, radiusB;
+    std::vector<Entry> stack;
+};
+
+// Descends both octrees at once and collects the pairs of occupied leaves
+// whose boxes overlap. aToB maps a's local frame into b's local frame.
+// Node boxes only differ per depth, so their projected sizes are computed
+// once per call and child centers are offsets of the parent center.
+// Once both nodes of a pair are at most one level above their leaves (up
+// to 8 each), their leaves are tested against each other directly instead
+// of through the stack, on b's axes and a's face axes only: the edge cross
+// products rarely separate two boxes that pass those, and skipping them
+// only adds pairs of nearly touching leaves. Trees with leaf grids skip the
+// descent for flat loops over the grids, see below.
+// With firstPerLeaf a leaf of a may stop at its first pair, for callers
+// that only need a's touching leaves; there can still be several.
+void collideLinearOctrees(const LinearOctree &a, const LinearOctree &b, const Mat4f &aToB,
+                          std::vector<std::pair<uint32_t, uint32_t>> &leafPairs, OctreePairScratch &scratch,
+                          bool firstPerLeaf = false)
+{
+    leafPairs.clear();
+    if (a.nodes.empty() || b.nodes.empty() || a.nodes[0].count == 0 || b.nodes[0].count == 0)
+        return;
+    int levelsA = a.levels();
+    int levelsB = b.levels();
+    // leaves only exist at maxDepth
+    if (levelsA != a.maxDepth || levelsB != b.maxDepth)
+        return;
+
+    // per depth: half edges of a's cells in b's frame, their extent along b's
+    // axes, their bounding radius, and the half size of b's cells
+    auto &edgeA = scratch.edgeA;
+    auto &extentA = scratch.extentA;
+    auto &halfB = scratch.halfB;
+    auto &radiusA = scratch.radiusA;
+    auto &radiusB = scratch.radiusB;
+    edgeA.resize(levelsA + 1);
+    extentA.resize(levelsA + 1);
+    radiusA.resize(levelsA + 1);
+    halfB.resize(levelsB + 1);
+    radiusB.resize(levelsB + 1);
+    for (int d = 1; d <= levelsA; d++)
+    {
+        Vec3f half = a.cellSize(d) / 2;
+        extentA[d] = Vec3f(0);
+        for (int i = 0; i < 3; i++)
+        {
+            edgeA[d][i] = Vec3f(aToB[i * 4 + 0], aToB[i * 4 + 1], aToB[i * 4 + 2]) * half[i];
+            for (int k = 0; k < 3; k++)
+                extentA[d][k] += fabs(edgeA[d][i][k]);
+        }
+        radiusA[d] = (edgeA[d][0] + edgeA[d][1] + edgeA[d][2]).mag();
+    }
+    for (int d = 1; d <= levelsB; d++)
+    {
+        halfB[d] = b.cellSize(d) / 2;
+        radiusB[d] = halfB[d].mag();
+    }
+
+    // a's face axes for two leaves, with the summed projected radius of both
+    // leaf boxes
+    Vec3f leafExtent = extentA[levelsA];
+    Vec3f leafHalf = halfB[levelsB];
+    Vec3f leafReach = leafExtent + leafHalf;
+    Vec3f axes[3];
+    float axisRadius[3];
+    int axisNum = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const auto &edge = edgeA[levelsA];
+        Vec3f L = edge[i];
+        if (L.magSqr() < 1e-24f)
+            continue;
+        axes[axisNum] = L;
+        axisRadius[axisNum] = fabs(L.dot(edge[0])) + fabs(L.dot(edge[1])) + fabs(L.dot(edge[2])) +
+                              leafHalf.x * fabs(L.x) + leafHalf.y * fabs(L.y) + leafHalf.z * fabs(L.z);
+        axisNum++;
+    }
+    auto leavesOverlap = [&](const Vec3f &centerA, const Vec3f &centerB) {
+        Vec3f d = centerA - centerB;
+        if (fabs(d.x) > leafReach.x || fabs(d.y) > leafReach.y || fabs(d.z) > leafReach.z)
+            return false;
+        for (int i = 0; i < axisNum; i++)
+        {
+            if (fabs(axes[i].dot(d)) > axisRadius[i])
+                return false;
+        }
+        return true;
+    };
+
+    // Shallow trees: the cells of a's grid that b's box reaches, then for
+    // each occupied one the cells of b's grid its leaf box spans. Flat loops
+    // beat the descent at these sizes, however deep the overlap.
+    if (!a.leafGrid.empty() && !b.leafGrid.empty())
+    {
+        // b's box in a's frame, through the inverse of aToB's linear part
+        float m[12]; // columns of aToB, translation last
+        for (int k = 0; k < 12; k++)
+            m[k] = aToB[k + k / 3];
+        float inverse[9] = {m[4] * m[8] - m[7] * m[5], m[7] * m[2] - m[1] * m[8], m[1] * m[5] - m[4] * m[2],
+                            m[6] * m[5] - m[3] * m[8], m[0] * m[8] - m[6] * m[2], m[3] * m[2] - m[0] * m[5],
+                            m[3] * m[7] - m[6] * m[4], m[6] * m[1] - m[0] * m[7], m[0] * m[4] - m[3] * m[1]};
+        float det = m[0] * inverse[0] + m[3] * inverse[1] + m[6] * inverse[2];
+        if (fabs(det) < 1e-30f)
+            return;
+        Vec3f boxCenter = (b.min + b.max) / 2 - Vec3f(m[9], m[10], m[11]), boxHalf = (b.max - b.min) / 2;
+        Vec3f regionCenter, regionHalf;
+        for (int r = 0; r < 3; r++)
+        {
+            float row[3] = {inverse[r] / det, inverse[r + 3] / det, inverse[r + 6] / det};
+            regionCenter[r] = row[0] * boxCenter.x + row[1] * boxCenter.y + row[2] * boxCenter.z;
+            regionHalf[r] = fabs(row[0]) * boxHalf.x + fabs(row[1]) * boxHalf.y + fabs(row[2]) * boxHalf.z;
+        }
+
+        // a's cells whose leaf box touches that region, widened a little so
+        // cells only touching count too, as in the descent
+        int nA = 1 << (a.maxDepth - 1);
+        Vec3f cellA = a.cellSize(a.maxDepth);
+        int range[3][2];
+        for (int k = 0; k < 3; k++)
+        {
+            float lo = (regionCenter[k] - regionHalf[k] - a.min[k]) / cellA[k] - 1e-4f;
+            float hi = (regionCenter[k] + regionHalf[k] - a.min[k]) / cellA[k] + 1e-4f;
+            if (hi < 0)
+                return;
+            range[k][0] = std::max((int)lo, 0);
+            range[k][1] = std::min((int)hi, nA - 1);
+            if (range[k][0] > range[k][1])
+                return;
+        }
+
+        int n = 1 << (b.maxDepth - 1);
+        Vec3f cell = b.cellSize(b.maxDepth);
+        Vec3f inverseCell(1 / cell.x, 1 / cell.y, 1 / cell.z);
+        Vec3f reach = leafExtent;
+        Vec3f reachCells(reach.x * inverseCell.x + 1e-4f, reach.y * inverseCell.y + 1e-4f,
+                         reach.z * inverseCell.z + 1e-4f);
+        // copies, so the stores into leafPairs need not reload them
+        Vec3f minB = b.min, maxB = b.max;
+        const int32_t *gridA = a.leafGrid.data(), *gridB = b.leafGrid.data();
+        const Vec3f *centersA = a.leafCenters.data(), *centersB = b.leafCenters.data();
+        uint32_t leafBeginA = a.leafBegin(), leafBeginB = b.leafBegin();
+        for (int zA = range[2][0]; zA <= range[2][1]; zA++)
+        {
+            for (int yA = range[1][0]; yA <= range[1][1]; yA++)
+            {
+                const int32_t *rowA = gridA + (yA + zA * nA) * nA;
+                for (int xA = range[0][0]; xA <= range[0][1]; xA++)
+                {
+                    if (rowA[xA] < 0)
+                        continue;
+                    const Vec3f &p = centersA[rowA[xA] - leafBeginA];
+                    Vec3f center(m[0] * p.x + m[3] * p.y + m[6] * p.z + m[9],
+                                 m[1] * p.x + m[4] * p.y + m[7] * p.z + m[10],
+                                 m[2] * p.x + m[5] * p.y + m[8] * p.z + m[11]);
+                    if (center.x + reach.x < minB.x || center.y + reach.y < minB.y ||
+                        center.z + reach.z < minB.z || center.x - reach.x > maxB.x ||
+                        center.y - reach.y > maxB.y || center.z - reach.z > maxB.z)
+                        continue;
+                    float fx = (center.x - minB.x) * inverseCell.x, fy = (center.y - minB.y) * inverseCell.y,
+                          fz = (center.z - minB.z) * inverseCell.z;
+                    int x0 = std::max((int)(fx - reachCells.x), 0);
+                    int x1 = std::min((int)(fx + reachCells.x), n - 1);
+                    int y0 = std::max((int)(fy - reachCells.y), 0);
+                    int y1 = std::min((int)(fy + reachCells.y), n - 1);
+                    int z0 = std::max((int)(fz - reachCells.z), 0);
+                    int z1 = std::min((int)(fz + reachCells.z), n - 1);
+                    // these cells are the ones within reach on b's axes,
+                    // only a's face axes are left to test
+                    bool found = false;
+                    for (int z = z0; z <= z1 && !found; z++)
+                    {
+                        for (int y = y0; y <= y1 && !found; y++)
+                        {
+                            const int32_t *row = gridB + (y + z * n) * n;
+                            for (int x = x0; x <= x1; x++)
+                            {
+                                if (row[x] < 0)
+                                    continue;
+                                Vec3f d = center - centersB[row[x] - leafBeginB];
+                                bool overlap = true;
+                                for (int i = 0; i < axisNum && overlap; i++)
+                                    overlap = fabs(axes[i].dot(d)) <= axisRadius[i];
+                                if (overlap)
+                                {
+                                    leafPairs.push_back({(uint32_t)rowA[xA], (uint32_t)row[x]});
+                                    if (firstPerLeaf)
+                                    {
+                                        found = true;
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // b's axes: a's box seen as an axis aligned box in b's frame
+    auto overlapsOnAxesB = [&](const Vec3f &centerA, int depthA, const Vec3f &centerB, int depthB) {
+        const Vec3f &extent = extentA[depthA];
+        const Vec3f &half = halfB[depthB];
+        return fabs(centerA.x - centerB.x) <= extent.x + half.x &&
+               fabs(centerA.y - centerB.y) <= extent.y + half.y &&
+               fabs(centerA.z - centerB.z) <= extent.z + half.z;
+    };
+    auto childCenterA = [&](const Vec3f &center, int depth, int c) {
+        auto &edge = edgeA[depth + 1];
+        Vec3f child = center;
+        for (int i = 0; i < 3; i++)
+        {
+            float sign = (c >> i & 1) ? 1.0f : -1.0f;
+            child.x += sign * edge[i].x;
+            child.y += sign * edge[i].y;
+            child.z += sign * edge[i].z;
+        }
+        return child;
+    };
+    auto childCenterB = [&](const Vec3f &center, int depth, int c) {
+        const Vec3f &half = halfB[depth + 1];
+        Vec3f child = center;
+        for (int i = 0; i < 3; i++)
+            child[i] += (c >> i & 1) ? half[i] : -half[i];
+        return child;
+    };
+
+    auto &stack = scratch.stack;
+    stack.clear();
+    OctreePairScratch::Entry root{0, 0, Vec3f(aToB * Vec4f((a.min + a.max) / 2, 1.0f)), (b.min + b.max) / 2};
+    if (overlapsOnAxesB(root.centerA, 1, root.centerB, 1))
+        stack.push_back(root);
+    uint32_t leavesA[8], leavesB[8];
+    Vec3f centersA[8], centersB[8];
+    while (!stack.empty())
+    {
+        OctreePairScratch::Entry entry = stack.back();
+        stack.pop_back();
+        const LinearOctreeNode &nodeA = a.nodes[entry.a];
+        const LinearOctreeNode &nodeB = b.nodes[entry.b];
+
+        if (nodeA.depth >= a.maxDepth - 1 && nodeB.depth >= b.maxDepth - 1)
+        {
+            // the leaves of both: the node itself or its children
+            int countA = 0, countB = 0;
+            if (a.isLeaf(nodeA))
+            {
+                leavesA[countA] = entry.a;
+                centersA[countA++] = entry.centerA;
+            }
+            else
+            {
+                uint32_t child = nodeA.firstChild;
+                for (int c = 0; c < 8; c++)
+                {
+                    if (!(nodeA.childMask & (1 << c)))
+                        continue;
+                    Vec3f center = childCenterA(entry.centerA, nodeA.depth, c);
+                    if (overlapsOnAxesB(center, nodeA.depth + 1, entry.centerB, nodeB.depth))
+                    {
+                        leavesA[countA] = child;
+                        centersA[countA++] = center;
+                    }
+                    child++;
+                }
+            }
+            if (b.isLeaf(nodeB))
+            {
+                leavesB[countB] = entry.b;
+                centersB[countB++] = entry.centerB;
+            }
+            else
+            {
+                uint32_t child = nodeB.firstChild;
+                for (int c = 0; c < 8; c++)
+                {
+                    if (!(nodeB.childMask & (1 << c)))
+                        continue;
+                    Vec3f center = childCenterB(entry.centerB, nodeB.depth, c);
+                    if (overlapsOnAxesB(entry.centerA, nodeA.depth, center, nodeB.depth + 1))
+                    {
+                        leavesB[countB] = child;
+                        centersB[countB++] = center;
+                    }
+                    child++;
+                }
+            }
+            for (int i = 0; i < countA; i++)
+            {
+                for (int j = 0; j < countB; j++)
+                {
+                    if (leavesOverlap(centersA[i], centersB[j]))
+                        leafPairs.push_back({leavesA[i], leavesB[j]});
+                }
+            }
+            continue;
+        }
+
+        // split the bigger node
+        bool leafA = a.isLeaf(nodeA);
+        if (!leafA && (b.isLeaf(nodeB) || radiusA[nodeA.depth] >= radiusB[nodeB.depth]))
+        {
+            uint32_t child = nodeA.firstChild;
+            for (int c = 0; c < 8; c++)
+            {
+                if (!(nodeA.childMask & (1 << c)))
+                    continue;
+                Vec3f center = childCenterA(entry.centerA, nodeA.depth, c);
+                if (overlapsOnAxesB(center, nodeA.depth + 1, entry.centerB, nodeB.depth))
+                    stack.push_back({child, entry.b, center, entry.centerB});
+                child++;
+            }
+        }
+        else
+        {
+            uint32_t child = nodeB.firstChild;
+            for (int c = 0; c < 8; c++)
+            {
+                if (!(nodeB.childMask & (1 << c)))
+                    continue;
+                Vec3f center = childCenterB(entry.centerB, nodeB.depth, c);
+                if (overlapsOnAxesB(entry.centerA, nodeA.depth, center, nodeB.depth + 1))
+                    stack.push_back({entry.a, child, entry.centerA, center});
+                child++;
+            }
+        }
+    }
+}
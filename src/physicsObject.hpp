@@ -2,26 +2,25 @@
 
 #include "object.hpp"
 #include "mesh_helper.hpp"
+#include "clothSolver.hpp"
+#include "contactSolver.hpp"
+#include "convexHull.hpp"
+#include "distanceField.hpp"
+#include "gjk.hpp"
 #include "octree.hpp"
-
-class RigidObject : public V1Object
+#include "rigidBodies.hpp"
+#include "simdKernels.hpp"
+#include "spatialHash.hpp"
+#include "staticColliders.hpp"
+#include "threadPool.hpp"
+
+// Collision data of a rigid mesh: bounds, octree, convex hull, distance
+// field, contact points and the octree line mesh. Shared by every RigidObject of the same
+// ObjectAsset. The proxy is a fixed budget of points standing in for the
+// octree leaves against the static scene and for the inertia, so a detailed
+// octree does not make those cost more.
+struct RigidAsset
 {
-public:
-    Vec3f v; // velocity;
-    Vec3f w; // angular velocity
-    Vec3f dv = 0;
-    Vec3f dw = 0;
-
-    float miu_t = 0.7;
-    float mass = 300;
-    Mat4f I_ref; // inertia matrix
-    Mat4f I_refInverse;
-
-    float linear_decay = 0.999f;
-    float angular_decay = 0.98f;
-    float restitution = 0.5f; // collision
-    float g = 9.8;
-
     Vec3f AABBmin;
     Vec3f AABBmax;
     Mesh AABB; // Actually, it's octree's mesh
@@ -30,40 +29,37 @@ public:
     BufferObject AABBbuffer;
     VAO AABBVao;
 
-    OctreeNode *root;
+    LinearOctree octree;
     int octreeDepth = 4;
-    Mesh octreeMesh;
-
-public:
-    RigidObject(const std::string meshPath = "", const std::string shaderPath = "./shaders/default",
-                const std::string texPath = "")
-        : V1Object(meshPath, shaderPath, texPath) {}
-
-    ~RigidObject()
-    {
-        if (root != nullptr)
-            deleteTree(root);
-    }
-
-    void Octree2Mesh(OctreeNode *node)
+    Mesh octreeMesh; // leaf centers, in the same order as the octree leaves
+    PointBuffer points; // octreeMesh vertices for the batch kernels
+    ConvexHull hull; // of the mesh vertices
+    bool convex = false; // the mesh is its own hull, pairs of such use GJK/EPA
+    int proxyBudget = 64;
+    PointBuffer proxy; // hull vertices, then leaf centers, spread out
+    std::vector<float> proxyWeight; // leaves each proxy point stands for
+    int sdfResolution = 64; // cells along the longest side, memory against accuracy
+    SignedDistanceField sdf; // of the mesh, for point queries
+    Mat4f secondMoment; // average r * r^T of the leaves, for the inertia of any mass and scale
+
+    bool built = false;
+    bool uploaded = false;
+
+    void Octree2Mesh()
     {
-        if (node != nullptr)
+        for (uint32_t i = octree.leafBegin(); i < octree.leafEnd(); i++)
         {
-            if (node->depth == octreeDepth)
-            {
-                addAABB(AABB, Vec3f(node->xmin, node->ymin, node->zmin),
-                        Vec3f(node->xmax, node->ymax, node->zmax));
-            }
-
-            for (int i = 0; i < 8; i++)
-            {
-                Octree2Mesh(node->children[i]);
-            }
+            Vec3f nodeMin, nodeMax;
+            octree.nodeBounds(octree.nodes[i], nodeMin, nodeMax);
+            addAABB(AABB, nodeMin, nodeMax);
         }
     }
 
-    void createAABBAndOctree()
+    // CPU part only, no GL calls: safe to run off the main thread
+    void computeAABBAndOctree(Mesh &mesh)
     {
+        if (built)
+            return;
         AABBmin = Vec3f(9999, 9999, 9999);
         AABBmax = Vec3f(-9999, -9999, -9999);
 
@@ -80,10 +76,21 @@ public:
         for (int i = 0; i < 3; i++) {
             AABBAverageLength[i] = (fabs(AABBmax[i]) + fabs(AABBmin[i])) / 2.0f;
         }
-        createOctree();
+        createOctree(mesh);
         // addAABB(AABB, AABBmin, AABBmax);
-        Octree2Mesh(root);
+        Octree2Mesh();
+        computeHullAndProxy(mesh);
+        computeSecondMoment();
+        sdf.resolution = sdfResolution;
+        sdf.build(mesh.vertices(), mesh.indices());
+        built = true;
+    }
 
+    void uploadAABB()
+    {
+        if (uploaded)
+            return;
+        uploaded = true;
         AABBVao.create();
         AABBVao.bind();
         AABBbuffer.bufferType(GL_ARRAY_BUFFER);
@@ -96,46 +103,153 @@ public:
         AABBVao.enableAttrib(0);
         AABBVao.attribPointer(0, AABBbuffer, 3, GL_FLOAT, 0, 0);
 
-        std::string shaderPath("./shaders/line");
-        std::fstream vert(std::string(shaderPath + ".vert").c_str(), std::ios::in);
-        std::fstream frag(std::string(shaderPath + ".frag").c_str(), std::ios::in);
-        std::stringstream vertStr;
-        std::stringstream fragStr;
-        if (!vert.good() || !frag.good())
-        {
-            std::cout << "ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
-        }
-        vertStr << vert.rdbuf();
-        fragStr << frag.rdbuf();
-        if (!AABBshader.compile(vertStr.str().c_str(), fragStr.str().c_str()))
-        {
-            std::cout << "ERROR: loading obj:(" << shaderPath << ") file is not good.\n";
-        }
-        vert.close();
-        frag.close();
+        loadShader(AABBshader, "./shaders/line");
     }
 
-    void createOctree()
+    void createOctree(Mesh &mesh)
     {
         // create AABB first
-        root = new OctreeNode();
-        root->depth = 1;
-        createMeshOctree(root, mesh, AABBmin.x, AABBmax.x,
-                         AABBmin.y, AABBmax.y,
-                         AABBmin.z, AABBmax.z, octreeDepth);
-
-        // preOrder(root);
-        // std::cout << "octree node num:" << nodeNum(root) << std::endl;
-        octreeToMesh(root, octreeMesh, octreeDepth);
+        createLinearOctree(octree, mesh, AABBmin, AABBmax, octreeDepth);
+
+        // std::cout << "octree node num:" << octree.nodes.size() << std::endl;
+        linearOctreeToMesh(octree, octreeMesh);
+        points.assign(octreeMesh.vertices());
         // std::cout << "octree mesh num:" << octreeMesh.vertices().size() << std::endl;
     }
 
+    void computeHullAndProxy(Mesh &mesh)
+    {
+        quickhull(mesh.vertices(), hull);
+        convex = isConvex(mesh.vertices(), hull, 1e-3f * (AABBmax - AABBmin).mag());
+        std::vector<Vec3f> picked;
+        proxyPoints(hull, octreeMesh.vertices(), proxyBudget, picked, proxyWeight);
+        proxy.assign(picked);
+    }
+
+    // from the proxy, each point weighted by the leaves it stands for
+    void computeSecondMoment()
+    {
+        float total = 0;
+        for (auto w : proxyWeight)
+            total += w;
+        secondMoment = Mat4f();
+        for (int k = 0; k < proxy.size(); k++)
+        {
+            Vec3f r = proxy.get(k);
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    secondMoment(i, j) += r[i] * r[j] * proxyWeight[k] / total;
+        }
+    }
+};
+
+// one RigidAsset per ObjectAsset and octree depth, while an instance uses it
+std::shared_ptr<RigidAsset> loadRigidAsset(const std::shared_ptr<ObjectAsset> &asset, int octreeDepth)
+{
+    static std::map<std::pair<ObjectAsset *, int>, std::weak_ptr<RigidAsset>> loaded;
+    auto &entry = loaded[{asset.get(), octreeDepth}];
+    auto rigid = entry.lock();
+    if (!rigid)
+    {
+        rigid = std::make_shared<RigidAsset>();
+        rigid->octreeDepth = octreeDepth;
+        entry = rigid;
+    }
+    return rigid;
+}
+
+// Velocity changes one rigidBodyCollision call hands to body a and its
+// partner b, kept aside so pairs can be computed in parallel and applied in
+// a fixed order.
+struct ContactImpulse
+{
+    int a = -1, b = -1;
+    bool touching = false; // the octrees touch
+    bool hit = false; // an impulse was computed
+    Vec3f dv, dw, objectDv, objectDw;
+
+    void apply(RigidBodies &bodies) const
+    {
+        if (!hit)
+            return;
+        bodies.addDelta(a, dv, dw);
+        bodies.addDelta(b, objectDv, objectDw);
+    }
+};
+
+// Handle to one body of a PhysicsWorld: the world keeps velocities, mass and
+// the rest of the dynamic state in its arrays and copies the pose back into
+// nav after every step. The handle holds the collision data and routines.
+class RigidObject : public V1Object
+{
+public:
+    RigidBodies *bodies = nullptr; // set by PhysicsWorld::addBody
+    int id = -1;
+
+    std::shared_ptr<RigidAsset> rigidAsset;
+    Vec3f &AABBmin;
+    Vec3f &AABBmax;
+    Vec3f &AABBAverageLength;
+    LinearOctree &octree;
+    Mesh &octreeMesh;
+    std::vector<std::pair<uint32_t, uint32_t>> leafPairs;
+    std::vector<uint32_t> contactLeaves;
+    OctreePairScratch octreePairs;
+    std::vector<uint32_t> staticHits; // scratch of collideStatic
+    std::vector<Vec3f> slotL, slotV;
+    std::vector<float> slotCount;
+    std::vector<std::pair<int, ContactPoint>> staticCandidates; // scratch of staticManifolds
+    std::vector<ContactPoint> candidates;
+
+    // pose cache, refreshed by updateTransform whenever nav changes
+    Mat4f worldR; // scale * rotation
+    Mat4f inverseWorldR;
+    Vec3f worldPos;
+    PointBuffer worldPoints; // the asset's proxy in world space
+
+public:
+    RigidObject(const std::string meshPath = "", const std::string shaderPath = "./shaders/default",
+                const std::string texPath = "", int octreeDepth = 4)
+        : RigidObject(loadObjectAsset(meshPath, shaderPath, texPath), octreeDepth) {}
+
+    RigidObject(std::shared_ptr<ObjectAsset> _asset, int octreeDepth = 4)
+        : RigidObject(_asset, loadRigidAsset(_asset, octreeDepth)) {}
+
+    RigidObject(std::shared_ptr<ObjectAsset> _asset, std::shared_ptr<RigidAsset> _rigidAsset)
+        : V1Object(_asset), rigidAsset(_rigidAsset),
+          AABBmin(_rigidAsset->AABBmin), AABBmax(_rigidAsset->AABBmax),
+          AABBAverageLength(_rigidAsset->AABBAverageLength),
+          octree(_rigidAsset->octree), octreeMesh(_rigidAsset->octreeMesh) {}
+
+    void createAABBAndOctree()
+    {
+        computeAABBAndOctree();
+        uploadAABB();
+    }
+
+    // CPU part only, no GL calls: safe to run off the main thread
+    void computeAABBAndOctree()
+    {
+        rigidAsset->computeAABBAndOctree(mesh);
+    }
+
+    void uploadAABB()
+    {
+        rigidAsset->uploadAABB();
+    }
+
     void drawAABB(Graphics &g, Nav &camera)
     {
+        drawAABB(g, camera, nav);
+    }
+
+    void drawAABB(Graphics &g, Nav &camera, const Pose &pose)
+    {
+        auto &AABBshader = rigidAsset->AABBshader;
         AABBshader.use();
 
-        g.translate(nav.pos());
-        g.rotate(nav.quat());
+        g.translate(pose.pos());
+        g.rotate(pose.quat());
         g.scale(scale);
 
         AABBshader.uniform("model", g.modelMatrix());
@@ -143,140 +257,275 @@ public:
         AABBshader.uniform("projection", g.projMatrix());
         AABBshader.uniform("color", Vec3f(1.0f, 0.5f, 0.7f));
 
-        AABBVao.bind();
-        glDrawArrays(GL_LINES, 0, AABB.vertices().size());
+        rigidAsset->AABBVao.bind();
+        glDrawArrays(GL_LINES, 0, rigidAsset->AABB.vertices().size());
     }
 
-    void initIRef()
+    // bounds of the rotated and scaled local AABB, for the broadphase
+    void worldAABB(Vec3f &min, Vec3f &max) override
     {
-        auto vertices = octreeMesh.vertices();
+        Mat4f R;
         Mat4f S = ScaleMatrix(scale);
-        float m = mass / vertices.size();
-        for (int i = 0; i < vertices.size(); i++)
+        nav.quat().toMatrix(R.elems());
+        R = S * R;
+        Vec3f center = (AABBmin + AABBmax) * 0.5f;
+        Vec3f half = (AABBmax - AABBmin) * 0.5f;
+        Vec3f c = Vec3f(R * Vec4f(center, 1.0f)) + Vec3f(nav.pos());
+        Vec3f extent;
+        for (int i = 0; i < 3; i++)
         {
-            vertices[i] = S * Vec4f(vertices[i], 1.0f);
-            float diag = m * vertices[i].magSqr();
-            I_ref += Mat4f(diag - m * vertices[i][0] * vertices[i][0], -m * vertices[i][0] * vertices[i][1], -m * vertices[i][0] * vertices[i][2], 0,
-                           -m * vertices[i][1] * vertices[i][0], diag - m * vertices[i][1] * vertices[i][1], -m * vertices[i][1] * vertices[i][2], 0,
-                           -m * vertices[i][2] * vertices[i][0], -m * vertices[i][2] * vertices[i][1], diag - m * vertices[i][2] * vertices[i][2], 0,
-                           0, 0, 0, 1);
+            extent[i] = fabsf(R(i, 0)) * half[0] + fabsf(R(i, 1)) * half[1] + fabsf(R(i, 2)) * half[2];
         }
-        I_refInverse = I_ref.inversed();
+        min = c - extent;
+        max = c + extent;
+    }
+
+    // I = m * (tr(S C S) * 1 - S C S) with C the asset's second moment
+    void initIRef()
+    {
+        float mass = bodies->mass[id];
+        Mat4f S = ScaleMatrix(scale);
+        Mat4f C = S * rigidAsset->secondMoment * S;
+        float trace = C(0, 0) + C(1, 1) + C(2, 2);
+        Mat4f &I_ref = bodies->I_ref[id];
+        I_ref = Mat4f(trace - C(0, 0), -C(0, 1), -C(0, 2), 0,
+                      -C(1, 0), trace - C(1, 1), -C(1, 2), 0,
+                      -C(2, 0), -C(2, 1), trace - C(2, 2), 0,
+                      0, 0, 0, 1.0f / mass) * mass;
+        bodies->I_refInverse[id] = I_ref.inversed();
     }
 
     void addVelocity(Vec3f _v = Vec3f(0, 7.0f, 0))
     {
-        restitution = 0.5;
-        v += _v;
+        bodies->wake(id);
+        bodies->restitution[id] = 0.5;
+        bodies->velocity(id, bodies->velocity(id) + _v);
     }
 
-    void collisonImpulse_plane(Vec3f P, Vec3f N)
+    // pose from the world, for drawing and the collision routines
+    void syncNav()
+    {
+        nav.pos(bodies->px[id], bodies->py[id], bodies->pz[id]);
+        nav.quat() = Quatd(bodies->qw[id], bodies->qx[id], bodies->qy[id], bodies->qz[id]);
+        updateTransform();
+    }
+
+    // once per pose: every collision query of a step reads the cache
+    void updateTransform()
     {
-        auto &vertices = octreeMesh.vertices();
-        Mat4f R;
         Mat4f S = ScaleMatrix(scale);
-        nav.quat().toMatrix(R.elems());
-        R = S * R;
-        Vec3f x = nav.pos();
-        Vec3f collideL(0);
-        Vec3f collideV(0);
-        float count = 0;
+        nav.quat().toMatrix(worldR.elems());
+        worldR = S * worldR;
+        inverseWorldR = worldR.inversed();
+        worldPos = nav.pos();
+        Mat4f M = worldR;
+        M(0, 3) = worldPos.x;
+        M(1, 3) = worldPos.y;
+        M(2, 3) = worldPos.z;
+        transformPoints(M, rigidAsset->proxy, worldPoints);
+    }
 
-        for (int i = 0; i < vertices.size(); i++)
+    // center of leaf i in world space
+    Vec3f leafCenter(int i) const
+    {
+        auto &points = rigidAsset->points;
+        return Vec3f(worldR(0, 0) * points.x[i] + worldR(0, 1) * points.y[i] + worldR(0, 2) * points.z[i],
+                     worldR(1, 0) * points.x[i] + worldR(1, 1) * points.y[i] + worldR(1, 2) * points.z[i],
+                     worldR(2, 0) * points.x[i] + worldR(2, 1) * points.y[i] + worldR(2, 2) * points.z[i]) +
+               worldPos;
+    }
+
+    ConvexShape shape() const { return ConvexShape{&rigidAsset->hull, worldR, worldPos}; }
+
+    // signed distance from the surface to a world point, negative inside,
+    // and the outward normal there. From the distance field, or the hull
+    // for a mesh without triangles
+    float surfaceDistance(const Vec3f &p, Vec3f &normal) const
+    {
+        Vec3f local = inverseWorldR * Vec4f(p - worldPos, 1.0f);
+        Vec3f gradient;
+        float d;
+        if (!rigidAsset->sdf.empty())
+            d = rigidAsset->sdf.sample(local, gradient);
+        else
         {
-            Vec3f Rri = R * Vec4f(vertices[i], 1.0f);
-            if ((x + Rri - P).dot(N) < 0)
+            auto &hull = rigidAsset->hull;
+            int face = 0;
+            for (int f = 1; f < hull.faces.size(); f++)
             {
-                Vec3f vi = v + w.cross(Rri);
-                if (dot(vi, N) < 0)
-                {
-                    collideL += Rri;
-                    collideV += vi;
-                    count += 1;
-                }
+                if (local.dot(hull.normals[f]) - hull.offsets[f] > local.dot(hull.normals[face]) - hull.offsets[face])
+                    face = f;
             }
+            gradient = hull.normals[face];
+            d = local.dot(gradient) - hull.offsets[face];
         }
-        if (count > 0)
-        {
-            collideL *= (1 / count);
-            collideV *= (1 / count);
-            Mat4f Rri_cross = CrossMatrix(collideL);
-            Vec3f j(0.0f); // Impulse
+        if (gradient.magSqr() < 1e-12f)
+            gradient = local.magSqr() > 0 ? local : Vec3f(0, 1, 0);
+        gradient = gradient.normalize();
+        // the gradient of the world field is inverseWorldR^T * gradient
+        const Mat4f &M = inverseWorldR;
+        normal = Vec3f(M(0, 0) * gradient.x + M(1, 0) * gradient.y + M(2, 0) * gradient.z,
+                       M(0, 1) * gradient.x + M(1, 1) * gradient.y + M(2, 1) * gradient.z,
+                       M(0, 2) * gradient.x + M(1, 2) * gradient.y + M(2, 2) * gradient.z);
+        float stretch = normal.mag();
+        normal /= stretch;
+        return d / stretch;
+    }
 
-            Vec3f v_ni = dot(collideV, N) * N;
-            Vec3f v_ti = collideV - v_ni;
+    // world velocity of the body at world point p
+    Vec3f pointVelocity(const Vec3f &p) const
+    {
+        return bodies->velocity(id) + bodies->angularVelocity(id).cross(p - worldPos);
+    }
 
-            float friction;
-            if (v_ti.mag() < 1e-5)
-                friction = 0;
-            else
-                friction = max(1 - miu_t * (1 + restitution) * v_ni.mag() / v_ti.mag(), 0.0f);
-            // 1 - μt(1 + μn)||Vni||/||Vti||
+    // the static scene, after the world has applied damping and gravity:
+    // one pass over the points for every collider, then an impulse per
+    // collider slot the body is pressing into
+    void collideStatic(const StaticColliderSet &colliders)
+    {
+        float &restitution = bodies->restitution[id];
+        if (bodies->velocity(id).mag() < 0.5f)
+        {
+            if (restitution < 1e-6) {
+                restitution = 0;
+            } else {
+                restitution *= 0.9;
+            }
+        }
+        else
+        {
+            restitution = 0.5;
+        }
 
-            v_ni *= -restitution;
-            v_ti *= friction;
-            //std::cout<< restitution<<","<<friction<<std::endl;
+        Vec3f v = bodies->velocity(id);
+        Vec3f w = bodies->angularVelocity(id);
+        Vec3f x = worldPos;
+        slotL.assign(colliders.slots(), Vec3f(0));
+        slotV.assign(colliders.slots(), Vec3f(0));
+        slotCount.assign(colliders.slots(), 0);
 
-            Mat4f K = Mat4f::identity() * (1 / mass) - Rri_cross * I_refInverse * Rri_cross;
-            j = K.inversed() * Vec4f(v_ni + v_ti - collideV, 1.0f);
+        colliders.hits(worldPoints, staticHits);
+        for (auto i : staticHits)
+        {
+            Vec3f p = worldPoints.get(i);
+            Vec3f Rri = p - x;
+            Vec3f vi = v + w.cross(Rri);
+            colliders.contacts(p, [&](int slot, float) {
+                if (dot(vi, colliders.normal(slot)) < 0)
+                {
+                    slotL[slot] += Rri;
+                    slotV[slot] += vi;
+                    slotCount[slot] += 1;
+                }
+            });
+        }
+        for (int slot = 0; slot < colliders.slots(); slot++)
+        {
+            if (slotCount[slot] > 0)
+                staticImpulse(slotL[slot], slotV[slot], slotCount[slot], colliders.normal(slot));
+        }
+    }
 
-            /*std::cout<<"I_ref"<<std::endl;
-            for(int i = 0; i < 16; i++){
-                std::cout<<I_ref[i]<<std::endl;
-            }
-            std::cout<<"I_refInverse"<<std::endl;
-            for(int i = 0; i < 16; i++){
-                std::cout<<I_refInverse[i]<<std::endl;
-            }
-            std::cout<<"K"<<std::endl;
-            for(int i = 0; i < 16; i++){
-                std::cout<<K[i]<<std::endl;
-            }
-            std::cout<<"J"<<std::endl;
-            std::cout<<j<<"\n";*/
+    // collideL and collideV are sums over count contact points
+    void staticImpulse(Vec3f collideL, Vec3f collideV, float count, Vec3f N)
+    {
+        float mass = bodies->mass[id];
+        float restitution = bodies->restitution[id];
+        float miu_t = bodies->miu_t[id];
+        Mat4f &I_refInverse = bodies->I_refInverse[id];
+        collideL *= (1 / count);
+        collideV *= (1 / count);
+        Mat4f Rri_cross = CrossMatrix(collideL);
+        Vec3f j(0.0f); // Impulse
+
+        Vec3f v_ni = dot(collideV, N) * N;
+        Vec3f v_ti = collideV - v_ni;
+
+        float friction;
+        if (v_ti.mag() < 1e-5)
+            friction = 0;
+        else
+            friction = max(1 - miu_t * (1 + restitution) * v_ni.mag() / v_ti.mag(), 0.0f);
+        // 1 - μt(1 + μn)||Vni||/||Vti||
 
-            dv += (1 / mass) * j;
+        v_ni *= -restitution;
+        v_ti *= friction;
+        //std::cout<< restitution<<","<<friction<<std::endl;
 
-            dw += I_refInverse * (Rri_cross * Vec4f(j, 1.0f));
+        Mat4f K = Mat4f::identity() * (1 / mass) - Rri_cross * I_refInverse * Rri_cross;
+        j = K.inversed() * Vec4f(v_ni + v_ti - collideV, 1.0f);
+
+        /*std::cout<<"I_ref"<<std::endl;
+        for(int i = 0; i < 16; i++){
+            std::cout<<I_ref[i]<<std::endl;
+        }
+        std::cout<<"I_refInverse"<<std::endl;
+        for(int i = 0; i < 16; i++){
+            std::cout<<I_refInverse[i]<<std::endl;
         }
+        std::cout<<"K"<<std::endl;
+        for(int i = 0; i < 16; i++){
+            std::cout<<K[i]<<std::endl;
+        }
+        std::cout<<"J"<<std::endl;
+        std::cout<<j<<"\n";*/
+
+        bodies->addDelta(id, (1 / mass) * j, I_refInverse * (Rri_cross * Vec4f(j, 1.0f)));
     }
 
-    void rigidBodyCollision(RigidObject &object)
+    // true when the octrees touch, even if the bodies are separating
+    bool rigidBodyCollision(RigidObject &object)
     {
-        auto &vertices = octreeMesh.vertices();
-        Mat4f R;
-        Mat4f S = ScaleMatrix(scale);
-        nav.quat().toMatrix(R.elems());
-        R = S * R;
-        Vec3f x = nav.pos();
+        ContactImpulse impulse;
+        contactImpulse(object, leafPairs, contactLeaves, octreePairs, impulse);
+        impulse.apply(*bodies);
+        return impulse.touching;
+    }
+
+    // the impulse rigidBodyCollision would apply, without touching any shared
+    // state: safe to run for many pairs at once with separate scratch vectors
+    void contactImpulse(const RigidObject &object, std::vector<std::pair<uint32_t, uint32_t>> &leafPairs,
+                        std::vector<uint32_t> &contactLeaves, OctreePairScratch &octreePairs,
+                        ContactImpulse &impulse) const
+    {
+        Vec3f v = bodies->velocity(id);
+        Vec3f w = bodies->angularVelocity(id);
+        float mass = bodies->mass[id];
+        float restitution = bodies->restitution[id];
+        float miu_t = bodies->miu_t[id];
+        const Mat4f &I_refInverse = bodies->I_refInverse[id];
+        float objectMass = bodies->mass[object.id];
+        const Mat4f &objectI_refInverse = bodies->I_refInverse[object.id];
+        Vec3f x = worldPos;
         Vec3f collideL(0);
         Vec3f collideV(0);
         Vec3f objectCollideL(0);
         Vec3f collideSurface;
         float count = 0;
 
-        Vec3f objectX = object.nav.pos();
-        Mat4f objectR;
-        Mat4f objectS = ScaleMatrix(object.scale);
-        object.nav.quat().toMatrix(objectR.elems());
-        objectR = objectS * objectR;
-        auto inverseObjectR = objectR.inversed();
+        Vec3f objectX = object.worldPos;
+        touchingLeaves(object, leafPairs, octreePairs, true);
 
-        for (int i = 0; i < vertices.size(); i++)
+        // leaves of this octree touching an occupied leaf of object, once each
+        contactLeaves.clear();
+        for (auto &pair : leafPairs)
+        {
+            contactLeaves.push_back(pair.first - octree.leafBegin());
+        }
+        std::sort(contactLeaves.begin(), contactLeaves.end());
+        contactLeaves.erase(std::unique(contactLeaves.begin(), contactLeaves.end()), contactLeaves.end());
+
+        for (auto i : contactLeaves)
         {
-            Vec3f Rri = R * Vec4f(vertices[i], 1.0f);
-            Vec3f transformedX = inverseObjectR * Vec4f(x + Rri - objectX, 1.0f);
-            if (inBox(transformedX, object.AABBmin, object.AABBmax))
+            Vec3f Rri = leafCenter(i) - x;
+            Vec3f vi = v + w.cross(Rri);
+            if (dot(vi, x + Rri - objectX) < 0)
             {
-                Vec3f vi = v + w.cross(Rri);
-                if (dot(vi, x + Rri - objectX) < 0)
-                {
-                    collideSurface += (x + Rri - objectX).normalize();
-                    objectCollideL += x + Rri - objectX;
-                    collideL += Rri;
-                    collideV += vi;
-                    count += 1;
-                }
+                collideSurface += (x + Rri - objectX).normalize();
+                objectCollideL += x + Rri - objectX;
+                collideL += Rri;
+                collideV += vi;
+                count += 1;
             }
         }
         // std::cout << count << std::endl;
@@ -307,67 +556,248 @@ public:
 
             Mat4f K = Mat4f::identity() * (1 / mass) - Rri_cross * I_refInverse * Rri_cross;
             j = K.inversed() * Vec4f(v_ni + v_ti - collideV, 1.0f);
-            dv += (1 / mass) * j / 2;
+            impulse.hit = true;
+            impulse.dv = (1 / mass) * j / 2;
+            impulse.dw = I_refInverse * (Rri_cross * Vec4f(j, 1.0f)) / 2;
+            impulse.objectDv = (1 / objectMass) * (-j) / 2;
+            impulse.objectDw = objectI_refInverse * (objectRri_cross * Vec4f(-j, 1.0f)) / 2;
+        }
+        impulse.a = id;
+        impulse.b = object.id;
+        impulse.touching = !contactLeaves.empty();
+    }
 
-            dw += I_refInverse * (Rri_cross * Vec4f(j, 1.0f)) / 2;
+    // pairs of overlapping leaves, this octree's first; with firstPerLeaf
+    // enough of them to name every touching leaf of this octree
+    void touchingLeaves(const RigidObject &object, std::vector<std::pair<uint32_t, uint32_t>> &leafPairs,
+                        OctreePairScratch &octreePairs, bool firstPerLeaf = false) const
+    {
+        // this octree in object's local frame
+        Mat4f toObject = object.inverseWorldR * worldR;
+        Vec3f offset = object.inverseWorldR * Vec4f(worldPos - object.worldPos, 1.0f);
+        toObject[12] = offset.x;
+        toObject[13] = offset.y;
+        toObject[14] = offset.z;
+        collideLinearOctrees(octree, object.octree, toObject, leafPairs, octreePairs, firstPerLeaf);
+    }
 
-            object.dv += (1 / object.mass) * (-j) / 2;
-            object.dw += object.I_refInverse * (objectRri_cross * Vec4f(-j, 1.0f)) / 2;
-        }
+    // smallest edge of a leaf box in world units
+    float leafSize() const
+    {
+        Vec3f size = octree.cellSize(octree.maxDepth);
+        return std::min(std::min(size.x * scale.x, size.y * scale.y), size.z * scale.z);
     }
 
-    void onAnimate(double dt) override
+    // farthest a point of the local AABB can be from the body's origin
+    float boundingRadius() const
     {
-        Vec3f Fg(0, -mass * g, 0);
-        v *= linear_decay;
-        v += (float)dt * Fg * (1 / mass);
-        w *= angular_decay;
-        if (v.mag() < 0.5f)
+        Vec3f far;
+        for (int i = 0; i < 3; i++)
+            far[i] = std::max(fabsf(AABBmin[i]), fabsf(AABBmax[i])) * scale[i];
+        return far.mag();
+    }
+
+    // half the extent of a leaf box along the world direction N
+    float leafExtent(const Vec3f &N) const
+    {
+        Vec3f half = octree.cellSize(octree.maxDepth) / 2;
+        float extent = 0;
+        for (int k = 0; k < 3; k++)
+            extent += fabsf(N.x * worldR(0, k) + N.y * worldR(1, k) + N.z * worldR(2, k)) * half[k];
+        return extent;
+    }
+
+    // Contact manifold against object for the ContactSolver, const like
+    // contactImpulse. Two convex bodies go through GJK/EPA on their hulls.
+    // Otherwise every pair of overlapping leaves is a candidate point
+    // halfway between their centers; the normal is the summed offset of the
+    // leaf pairs. Leaves overlapping by less than their size only touch at
+    // this resolution, so a point is only as deep as its two leaf centers
+    // have passed each other along the normal.
+    void contactManifold(const RigidObject &object, std::vector<std::pair<uint32_t, uint32_t>> &leafPairs,
+                         OctreePairScratch &octreePairs, std::vector<ContactPoint> &candidates,
+                         ContactManifold &manifold) const
+    {
+        manifold.a = id;
+        manifold.b = object.id;
+        manifold.key = ContactManifold::pairKey(id, object.id);
+        manifold.count = 0;
+        if (rigidAsset->convex && object.rigidAsset->convex)
         {
-            if (restitution < 1e-6) {
-                restitution = 0;
-            } else {
-                restitution *= 0.9;
-            }
+            std::array<Vec3f, 4> simplex;
+            if (gjk(shape(), object.shape(), simplex))
+                convexManifold(object, simplex, candidates, manifold);
+            return;
         }
-        else
+        touchingLeaves(object, leafPairs, octreePairs);
+        if (leafPairs.empty())
+            return;
+
+        uint32_t leafBegin = octree.leafBegin(), objectLeafBegin = object.octree.leafBegin();
+        Vec3f N(0);
+        for (auto &pair : leafPairs)
+            N += leafCenter(pair.first - leafBegin) - object.leafCenter(pair.second - objectLeafBegin);
+        if (N.magSqr() < 1e-12f)
+            N = worldPos - object.worldPos;
+        manifold.setNormal(N.normalize());
+        N = manifold.normal;
+        float extent = leafExtent(N) + object.leafExtent(N);
+
+        candidates.clear();
+        for (auto &pair : leafPairs)
         {
-            restitution = 0.5;
+            uint32_t i = pair.first - leafBegin, j = pair.second - objectLeafBegin;
+            Vec3f pa = leafCenter(i), pb = object.leafCenter(j);
+            Vec3f p = (pa + pb) * 0.5f;
+            ContactPoint c;
+            c.key = (uint64_t)i << 32 | j;
+            c.rA = p - worldPos;
+            c.rB = p - object.worldPos;
+            c.depth = std::max(-(pa - pb).dot(N), 0.0f);
+            candidates.push_back(c);
         }
+        manifold.reduce(candidates);
+        manifold.friction = sqrtf(bodies->miu_t[id] * bodies->miu_t[object.id]);
+        manifold.restitution = std::max(bodies->restitution[id], bodies->restitution[object.id]);
+        manifold.matchRadius = extent;
+    }
 
-        collisonImpulse_plane(Vec3f(0, -1.5f, 0), Vec3f(0, 1, 0));
-        collisonImpulse_plane(Vec3f(15.0f, 0, 0), Vec3f(-1, 0, 0));
-        collisonImpulse_plane(Vec3f(-15.0f, 0, 0), Vec3f(1, 0, 0));
-        collisonImpulse_plane(Vec3f(0, 0, 15.0f), Vec3f(0, 0, -1));
-        collisonImpulse_plane(Vec3f(0, 0, -15.0f), Vec3f(0, 0, 1));
+    // Manifold of two overlapping convex bodies from EPA's normal and depth:
+    // the vertices of either hull that are inside the other, each as deep as
+    // it lies past the other's face. Without any (edge against edge) the
+    // point between the two deepest vertices.
+    void convexManifold(const RigidObject &object, const std::array<Vec3f, 4> &simplex,
+                        std::vector<ContactPoint> &candidates, ContactManifold &manifold) const
+    {
+        ConvexShape a = shape(), b = object.shape();
+        Vec3f n; // from this body into object
+        float depth;
+        if (!epa(a, b, simplex, n, depth))
+            return;
+        manifold.setNormal(-n);
+        float tolerance = 0.02f * std::min(boundingRadius(), object.boundingRadius());
+
+        candidates.clear();
+        // vertices of from's hull inside to's, deepest along dir
+        auto inside = [&](const RigidObject &from, const ConvexShape &fromShape, const RigidObject &to,
+                          const Vec3f &dir, uint64_t keyBit, float side) {
+            float deepest = fromShape.support(dir).dot(dir);
+            for (int i = 0; i < from.rigidAsset->hull.vertices.size(); i++)
+            {
+                Vec3f v = fromShape.vertex(i);
+                Vec3f local = to.inverseWorldR * Vec4f(v - to.worldPos, 1.0f);
+                if (to.rigidAsset->hull.distance(local) > tolerance)
+                    continue;
+                ContactPoint c;
+                c.depth = std::max(depth - (deepest - v.dot(dir)), 0.0f);
+                Vec3f p = v + n * (side * c.depth / 2);
+                c.key = keyBit | i;
+                c.rA = p - worldPos;
+                c.rB = p - object.worldPos;
+                candidates.push_back(c);
+            }
+        };
+        inside(*this, a, object, n, 0, -1);
+        inside(object, b, *this, -n, 1ull << 31, 1);
+        if (candidates.empty())
+        {
+            ContactPoint c;
+            Vec3f p = (a.support(n) + b.support(-n)) * 0.5f;
+            c.depth = depth;
+            c.rA = p - worldPos;
+            c.rB = p - object.worldPos;
+            candidates.push_back(c);
+        }
+        manifold.reduce(candidates);
+        manifold.friction = sqrtf(bodies->miu_t[id] * bodies->miu_t[object.id]);
+        manifold.restitution = std::max(bodies->restitution[id], bodies->restitution[object.id]);
+        manifold.matchRadius = tolerance * 5;
+    }
 
-        v += dv;
-        w += dw;
-        dv = 0;
-        dw = 0;
+    // one manifold per static collider slot the body is in, appended to
+    // manifolds; the points are the leaf centers behind the slot
+    void staticManifolds(const StaticColliderSet &colliders, std::vector<ContactManifold> &manifolds)
+    {
+        colliders.hits(worldPoints, staticHits);
+        staticCandidates.clear();
+        for (auto i : staticHits)
+        {
+            Vec3f p = worldPoints.get(i);
+            colliders.contacts(p, [&](int slot, float depth) {
+                ContactPoint c;
+                c.key = i;
+                c.rA = p - worldPos;
+                c.depth = depth;
+                staticCandidates.push_back({slot, c});
+            });
+        }
+        std::stable_sort(staticCandidates.begin(), staticCandidates.end(),
+                         [](const std::pair<int, ContactPoint> &a, const std::pair<int, ContactPoint> &b) {
+                             return a.first < b.first;
+                         });
+        for (int begin = 0, end; begin < staticCandidates.size(); begin = end)
+        {
+            int slot = staticCandidates[begin].first;
+            candidates.clear();
+            for (end = begin; end < staticCandidates.size() && staticCandidates[end].first == slot; end++)
+                candidates.push_back(staticCandidates[end].second);
+            ContactManifold manifold;
+            manifold.a = id;
+            manifold.key = ContactManifold::staticKey(id, slot);
+            manifold.setNormal(colliders.normal(slot));
+            manifold.reduce(candidates);
+            manifold.friction = bodies->miu_t[id];
+            manifold.restitution = bodies->restitution[id];
+            manifold.matchRadius = 2 * leafExtent(manifold.normal);
+            manifolds.push_back(manifold);
+        }
+    }
 
-        auto &x = nav.pos();
-        x += (float)dt * v;
-        Quatf dq(0, w.x * dt * 0.5, w.y * dt * 0.5, w.z * dt * 0.5);
+    // PhysicsWorld integrates every body at once
+    void onAnimate(double dt) override {}
 
-        auto &q = nav.quat();
-        q += dq * q;
-        q.normalize();
-    }
 };
 
+// Builds the octrees of many bodies at once across the thread pool, then
+// uploads their GL buffers on the calling (GL) thread. Bodies sharing an
+// asset build it once.
+void createAABBAndOctrees(std::vector<std::shared_ptr<RigidObject>> &objects)
+{
+    std::vector<RigidObject *> unbuilt;
+    for (auto &object : objects)
+    {
+        bool seen = false;
+        for (auto other : unbuilt)
+            seen |= other->rigidAsset == object->rigidAsset;
+        if (!object->rigidAsset->built && !seen)
+            unbuilt.push_back(object.get());
+    }
+    ThreadPool::instance().parallelFor(unbuilt.size(), [&](int i) {
+        unbuilt[i]->computeAABBAndOctree();
+    });
+    for (auto &object : objects)
+    {
+        object->uploadAABB();
+    }
+}
+
 class MassSpring : public V1Object
 {
 public:
-    float mass = 1.0f;
-    float damping = 0.99f;
-    float rho = 0.995f;
-    float spring_k = 80000;
-    std::vector<int> E;
-    std::vector<float> L;
-    std::vector<Vec3f> V;
-    Vec3f g = Vec3f(0, -9.8f, 0);
+    ClothSolver solver;
     int n = 81;
+    std::vector<Vec3f> worldX; // world space vertices, stepped and then queried by contacts
+    SpatialHash hash;
+    float hashCellSize = 0.5f;
+    float thickness = 0.02f; // kept between the cloth and rigid surfaces
+    std::vector<uint32_t> candidates; // scratch of rigidBodyCollision
+    PointBuffer candidatePoints;
+    std::vector<uint32_t> inside;
+    const StaticColliderSet *colliders = nullptr; // the scene's, if any
+    PointBuffer staticPoints; // scratch of collideStatic
+    std::vector<uint32_t> staticHits;
+    std::vector<Vec3f> lastVertices; // before the last step, for interpolate
+    std::vector<Vec3f> drawVertices;
 
     MassSpring(const std::string meshPath = "", const std::string shaderPath = "./shaders/default",
                const std::string texPath = "")
@@ -377,76 +807,12 @@ public:
     {
         V1Object::onCreate();
         mesh.reset();
-        std::vector<Vec3f> X(n * n);
-        std::vector<Vec2f> UV(n * n);
-        std::vector<Mesh::Index> triangles((n - 1) * (n - 1) * 6);
-        for (int j = 0; j < n; j++)
-        {
-            for (int i = 0; i < n; i++)
-            {
-                X[j * n + i] = Vec3f(5 - 10.0f * i / (n - 1), 0, 5 - 10.0f * j / (n - 1));
-                UV[j * n + i] = Vec2f(i / (n - 1.0f), j / (n - 1.0f));
-            }
-        }
-        int t = 0;
-        for (int j = 0; j < n - 1; j++)
-        {
-            for (int i = 0; i < n - 1; i++)
-            {
-                triangles[t * 6 + 0] = j * n + i;
-                triangles[t * 6 + 1] = j * n + i + 1;
-                triangles[t * 6 + 2] = (j + 1) * n + i + 1;
-                triangles[t * 6 + 3] = j * n + i;
-                triangles[t * 6 + 4] = (j + 1) * n + i + 1;
-                triangles[t * 6 + 5] = (j + 1) * n + i;
-                t++;
-            }
-        }
-        std::vector<int> _E(triangles.size() * 2);
-        for (int i = 0; i < triangles.size(); i += 3)
-        {
-            _E[i * 2 + 0] = triangles[i + 0];
-            _E[i * 2 + 1] = triangles[i + 1];
-            _E[i * 2 + 2] = triangles[i + 1];
-            _E[i * 2 + 3] = triangles[i + 2];
-            _E[i * 2 + 4] = triangles[i + 2];
-            _E[i * 2 + 5] = triangles[i + 0];
-        }
-        for (int i = 0; i < _E.size(); i += 2)
-        {
-            if (_E[i] > _E[i + 1])
-                std::swap(_E[i], _E[i + 1]);
-        }
-        QuickSort(_E, 0, _E.size() / 2 - 1);
-
-        int eNumber = 0;
-        for (int i = 0; i < _E.size(); i += 2)
-        {
-            if (i == 0 || _E[i + 0] != _E[i - 2] || _E[i + 1] != _E[i - 1])
-                eNumber++;
-        }
-        E.resize(eNumber * 2);
-        for (int i = 0, e = 0; i < _E.size(); i += 2)
-        {
-            if (i == 0 || _E[i + 0] != _E[i - 2] || _E[i + 1] != _E[i - 1])
-            {
-                E[e * 2 + 0] = _E[i + 0];
-                E[e * 2 + 1] = _E[i + 1];
-                e++;
-            }
-        }
-        L.resize(E.size() / 2);
-        for (int e = 0; e < E.size() / 2; e++)
-        {
-            int v0 = E[e * 2 + 0];
-            int v1 = E[e * 2 + 1];
-            L[e] = (X[v0] - X[v1]).mag();
-        }
-        V.resize(X.size());
-        for (int i = 0; i < V.size(); i++)
-        {
-            V[i] = Vec3f(0, 0, 0);
-        }
+        std::vector<Vec3f> X;
+        std::vector<Vec2f> UV;
+        std::vector<Mesh::Index> triangles;
+        clothGrid(n, 10, X, UV, triangles);
+        solver.setMesh(X, triangles);
+        solver.pinned[0] = solver.pinned[n - 1] = 1;
 
         mesh.vertices() = X;
         mesh.indices() = triangles;
@@ -454,24 +820,9 @@ public:
         generateNormals();
         reBindAll();
     }
-    void computeGradient(std::vector<Vec3f> &X, std::vector<Vec3f> &XHat, float t, std::vector<Vec3f>& G)
-    {
-        for (int i = 0; i < G.size(); i++)
-        {
-            G[i] = (1 / t) * mass * (X[i] - XHat[i]) * (1 / t);
-            G[i] -= mass * g;
-        }
-        for (int e = 0; e < E.size() / 2; e++)
-        {
-            int i = E[e * 2 + 0];
-            int j = E[e * 2 + 1];
-            Vec3f dir = X[i] - X[j];
-            
-            G[i] += spring_k * (1 - L[e] / (dir).mag()) * (dir);
-            G[j] -= spring_k * (1 - L[e] / (dir).mag()) * (dir);
-        }
-    }
 
+    // one step; the GPU copy is only updated by interpolate. Nothing here
+    // allocates once the buffers have their sizes
     void onAnimate(double dt) override {
         Mat4f R;
         Mat4f S = ScaleMatrix(scale);
@@ -480,94 +831,114 @@ public:
         Mat4f InversedR = R.inversed();
         Vec3f x = nav.pos();
 
-        auto X = mesh.vertices();
-        for (int i = 0; i < X.size(); i++) {
-            X[i] = Vec3f(R * Vec4f(X[i], 1.0f)) + x;
-        }
-        std::vector<Vec3f> last_X(X.size());
-        std::vector<Vec3f> XHat(X.size());
-        std::vector<Vec3f> G(X.size());
-
-        for (int i = 0; i < X.size(); i++) {
-            V[i] *= damping;
-            XHat[i] = X[i] + V[i] * dt;
-            X[i] = XHat[i];
-            last_X[i] = Vec3f(0);
-            G[i] = Vec3f(0);
+        auto &vertices = mesh.vertices();
+        lastVertices = vertices;
+        worldX.resize(vertices.size());
+        for (int i = 0; i < vertices.size(); i++) {
+            worldX[i] = Vec3f(R * Vec4f(vertices[i], 1.0f)) + x;
         }
+        solver.step(worldX, dt);
 
-        for (int k = 0; k < 32; k++) {
-            float w = 0;
-            computeGradient(X, XHat, dt, G);
-            if (k == 0) w = 1;
-            else if (k == 1) w = 2 / (2 - rho * rho);
-            else w = 4 / (4 - rho * rho * w);
-            auto oldX = X;
-            for (int i = 0; i < X.size(); i++) {
-                if (i == 0 || i == n - 1) continue;
-                X[i] -= G[i] / (float)((1 / dt) * mass * (1 / dt) + 4 * spring_k);
-                X[i] = w * X[i] + (1 - w) * last_X[i];
-            }
-            last_X = oldX;
-        }
-        for (int i = 0; i < X.size(); i++) {
-            if (i == 0 || i == n - 1) continue;
-            V[i] += (X[i] - XHat[i]) * (1 / dt);
-        }
+        if (colliders)
+            collideStatic(worldX, dt);
+        hash.build(worldX, hashCellSize);
 
-        for (int i = 0; i < X.size(); i++) {
-            X[i] = Vec3f(InversedR * Vec4f(X[i] - x, 1.0f));
+        for (int i = 0; i < vertices.size(); i++) {
+            vertices[i] = Vec3f(InversedR * Vec4f(worldX[i] - x, 1.0f));
         }
+    }
 
-        mesh.vertices() = X;
-
-        collisonImpulse_plane(Vec3f(0, -1.5f, 0), Vec3f(0, 1, 0), dt);
-        collisonImpulse_plane(Vec3f(15.0f, 0, 0), Vec3f(-1, 0, 0), dt);
-        collisonImpulse_plane(Vec3f(-15.0f, 0, 0), Vec3f(1, 0, 0), dt);
-        collisonImpulse_plane(Vec3f(0, 0, 15.0f), Vec3f(0, 0, -1), dt);
-        collisonImpulse_plane(Vec3f(0, 0, -15.0f), Vec3f(0, 0, 1), dt);
+    // vertices blended between the last two steps, uploaded for drawing
+    void interpolate(float alpha)
+    {
+        auto &vertices = mesh.vertices();
+        if (lastVertices.size() != vertices.size())
+        {
+            reBindVertices();
+            return;
+        }
+        drawVertices.resize(vertices.size());
+        for (int i = 0; i < vertices.size(); i++)
+        {
+            drawVertices[i] = lastVertices[i] + (vertices[i] - lastVertices[i]) * alpha;
+        }
+        upload(drawVertices);
+    }
 
-        reBindVertices();
+    // vertices to draw, which need not be mesh.vertices()
+    void upload(const std::vector<Vec3f> &X)
+    {
+        bufferArray[0].bind();
+        bufferArray[0].data(X.size() * sizeof(float) * 3, X.data());
     }
-    // after scale
-    void reCalculateL() {
-        auto& X = mesh.vertices();
-        for (int e = 0; e < E.size() / 2; e++)
+
+    void worldAABB(Vec3f &min, Vec3f &max) override
+    {
+        if (worldX.size() != mesh.vertices().size())
+            buildHash();
+        min = Vec3f(9999, 9999, 9999);
+        max = Vec3f(-9999, -9999, -9999);
+        for (auto &p : worldX)
         {
-            int v0 = E[e * 2 + 0];
-            int v1 = E[e * 2 + 1];
-            L[e] = (X[v0] * scale - X[v1] * scale).mag();
+            for (int i = 0; i < 3; i++)
+            {
+                min[i] = std::min(min[i], p[i]);
+                max[i] = std::max(max[i], p[i]);
+            }
         }
     }
 
-    void collisonImpulse_plane(Vec3f P, Vec3f N, float dt) {
-        auto &vertices = mesh.vertices();
-        N = N.normalize();
+    void buildHash()
+    {
         Mat4f R;
         Mat4f S = ScaleMatrix(scale);
         nav.quat().toMatrix(R.elems());
         R = S * R;
-        Mat4f InversedR = R.inversed();
         Vec3f x = nav.pos();
-
-
+        auto &vertices = mesh.vertices();
+        worldX.resize(vertices.size());
         for (int i = 0; i < vertices.size(); i++)
         {
-            Vec3f Rri = R * Vec4f(vertices[i], 1.0f);
-            if ((x + Rri - P).dot(N) < 0)
-            {
-                if (dot(V[i], N) < 0)
+            worldX[i] = Vec3f(R * Vec4f(vertices[i], 1.0f)) + x;
+        }
+        hash.build(worldX, hashCellSize);
+    }
+    // after scale
+    void reCalculateL() {
+        auto& X = mesh.vertices();
+        for (int e = 0; e < solver.springs; e++)
+        {
+            int v0 = solver.springA[e];
+            int v1 = solver.springB[e];
+            solver.L[e] = (X[v0] * scale - X[v1] * scale).mag();
+        }
+    }
+
+    // X in world space; one pass over the points for every collider, then
+    // the colliders in order for the few points that hit one
+    void collideStatic(std::vector<Vec3f> &X, float dt) {
+        staticPoints.assign(X);
+        colliders->hits(staticPoints, staticHits);
+        for (auto i : staticHits)
+        {
+            // pushes move X[i] before the next collider tests it
+            colliders->contacts(X[i], [&](int slot, float depth) {
+                Vec3f N = colliders->normal(slot);
+                Vec3f v = solver.V.get(i);
+                if (dot(v, N) < 0)
                 {
-                    float dis = (x + Rri - P).dot(N);
-                    Vec3f newX = x + Rri + (-dis + Vec3f(0.01f)) * N;
-                    V[i] += -dis * (1 / dt) * N;
-                    vertices[i] = Vec3f(InversedR * Vec4f(newX - x, 1.0f));
+                    X[i] += (depth + Vec3f(0.01f)) * N;
+                    solver.V.set(i, v + depth * (1 / dt) * N);
                 }
-            }
+            });
         }
     }
 
+    // only the vertices hashed near the object's bounds are tested, each
+    // against the object's distance field
     void rigidBodyCollision(RigidObject &object, float dt) {
+        if (worldX.size() != mesh.vertices().size())
+            buildHash();
         auto &vertices = mesh.vertices();
         Mat4f R;
         Mat4f S = ScaleMatrix(scale);
@@ -575,34 +946,44 @@ public:
         R = S * R;
         Mat4f InversedR = R.inversed();
         Vec3f x = nav.pos();
-        Vec3f collideL(0);
-        Vec3f collideV(0);
-        Vec3f objectCollideL(0);
-        Vec3f collideSurface;
-        float count = 0;
 
-        Vec3f objectX = object.nav.pos();
-        Mat4f objectR;
-        Mat4f objectS = ScaleMatrix(object.scale);
-        object.nav.quat().toMatrix(objectR.elems());
-        objectR = objectS * objectR;
-        auto inverseObjectR = objectR.inversed();
+        Vec3f objectX = object.worldPos;
+        Mat4f &inverseObjectR = object.inverseWorldR;
+
+        Vec3f objectMin, objectMax;
+        object.worldAABB(objectMin, objectMax);
+        candidates.clear();
+        hash.query(objectMin, objectMax, [&](uint32_t i) {
+            if (i == 0 || i == n - 1) return;
+            candidates.push_back(i);
+        });
+        candidatePoints.resize(candidates.size());
+        for (int k = 0; k < candidates.size(); k++)
+        {
+            candidatePoints.set(k, worldX[candidates[k]]);
+        }
 
-        for (int i = 0; i < vertices.size(); i++)
+        // world to the object's local frame, in one matrix for the box test
+        Mat4f toObject = inverseObjectR;
+        Vec3f offset = inverseObjectR * Vec4f(-objectX, 1.0f);
+        toObject(0, 3) = offset.x;
+        toObject(1, 3) = offset.y;
+        toObject(2, 3) = offset.z;
+        pointsInBox(toObject, candidatePoints, object.AABBmin, object.AABBmax, inside);
+        for (auto k : inside)
         {
-            if (i == 0 || i == n - 1) continue;
-            Vec3f Rri = R * Vec4f(vertices[i], 1.0f);
-            Vec3f transformedX = inverseObjectR * Vec4f(x + Rri - objectX, 1.0f);
-            if (inBox(transformedX, object.AABBmin, object.AABBmax))
-            {
-                {//if ((- x - Rri + objectX).dot(V[i]) > 0) {
-                    if (transformedX.mag() < object.AABBAverageLength.mag() * 1.0f) {
-                        transformedX = transformedX.normalize() * object.AABBAverageLength.mag() * 1.0f;
-                        Vec3f newX = objectR * Vec4f(transformedX, 1.0f) + objectX;
-                        V[i] += (newX - x - Rri) / dt;
-                        vertices[i] = Vec3f(InversedR * Vec4f(newX - x, 1.0f));
-                    }
-                }
+            int i = candidates[k];
+            Vec3f N;
+            float depth = thickness - object.surfaceDistance(worldX[i], N);
+            if (depth > 0) {
+                Vec3f newX = worldX[i] + N * depth;
+                // no velocity into the body, relative to its surface
+                Vec3f v = solver.V.get(i);
+                float vn = dot(v - object.pointVelocity(newX), N);
+                if (vn < 0)
+                    solver.V.set(i, v - vn * N);
+                vertices[i] = Vec3f(InversedR * Vec4f(newX - x, 1.0f));
+                worldX[i] = newX;
             }
         }
     }
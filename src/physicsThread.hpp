@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "al/spatial/al_Pose.hpp"
+#include "fixedTimestep.hpp"
+
+using namespace al;
+
+// One writer hands whole states to one reader. The writer fills back() and
+// publishes it; front() gives the reader the newest published state. The
+// third slot sits between them, so neither side ever waits for the other.
+template <class T>
+class TripleBuffer
+{
+public:
+    T &back() { return slots[backIndex]; }
+
+    void publish() { backIndex = middle.exchange(backIndex | fresh) & ~fresh; }
+
+    // the newest published state, unchanged until the next call
+    const T &front()
+    {
+        if (middle.load() & fresh)
+            frontIndex = middle.exchange(frontIndex) & ~fresh;
+        return slots[frontIndex];
+    }
+
+private:
+    static const int fresh = 4; // middle holds a state the reader has not seen
+    T slots[3];
+    int backIndex = 0;
+    int frontIndex = 1;
+    std::atomic<int> middle{2};
+};
+
+// What drawing needs of the last step: rigid poses and cloth vertices before
+// and after it, to blend between.
+struct PhysicsSnapshot
+{
+    double time = 0; // PhysicsThread::now() when the step finished
+    float step = 0.016f;
+    std::vector<Vec3f> lastPos, pos;
+    std::vector<Quatf> lastQuat, quat;
+    std::vector<std::vector<Vec3f>> lastCloth, cloth; // local vertices
+    std::vector<int> clothIterations; // of each cloth's last step
+    std::vector<float> clothResiduals; // m/s
+
+    // drawing runs one step behind, reaching pos when the next step is due
+    float alpha(double now) const { return std::min(std::max((now - time) / step, 0.0), 1.0); }
+
+    int bodies() const { return pos.size(); }
+
+    Pose pose(int i, float alpha) const
+    {
+        Vec3f p = lastPos[i] + (pos[i] - lastPos[i]) * alpha;
+        Quatf q = Quatf::slerp(lastQuat[i], quat[i], alpha);
+        return Pose(Vec3d(p.x, p.y, p.z), Quatd(q.w, q.x, q.y, q.z));
+    }
+
+    void clothVertices(int c, float alpha, std::vector<Vec3f> &X) const
+    {
+        X.resize(cloth[c].size());
+        for (int i = 0; i < X.size(); i++)
+            X[i] = lastCloth[c][i] + (cloth[c][i] - lastCloth[c][i]) * alpha;
+    }
+};
+
+// Runs the simulation on its own thread at the fixed rate of timestep and
+// publishes a snapshot after each batch of steps. Everything else talks to
+// the simulation through post(), whose functions run on the physics thread
+// between steps, so the drawing side only takes a lock when it posts.
+class PhysicsThread
+{
+public:
+    FixedTimestep timestep; // owned by the physics thread once started
+    std::function<void(float)> step; // one simulation step
+    std::function<void(PhysicsSnapshot &)> publish; // fills a snapshot
+
+    ~PhysicsThread() { stop(); }
+
+    void start()
+    {
+        if (thread.joinable())
+            return;
+        quit = false;
+        thread = std::thread([this]() { loop(); });
+    }
+
+    void stop()
+    {
+        if (!thread.joinable())
+            return;
+        quit = true;
+        thread.join();
+    }
+
+    bool running() const { return thread.joinable(); }
+
+    // fn runs on the physics thread before its next step
+    void post(std::function<void()> fn)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(fn));
+    }
+
+    // for the drawing thread only
+    const PhysicsSnapshot &latest() { return snapshots.front(); }
+
+    static double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::thread thread;
+    std::atomic<bool> quit{false};
+    std::mutex mutex;
+    std::vector<std::function<void()>> commands;
+    std::vector<std::function<void()>> runningCommands;
+    TripleBuffer<PhysicsSnapshot> snapshots;
+
+    void loop()
+    {
+        double last = now();
+        while (!quit)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::swap(commands, runningCommands);
+            }
+            for (auto &fn : runningCommands)
+                fn();
+            runningCommands.clear();
+
+            double t = now();
+            int steps = timestep.advance(t - last);
+            last = t;
+            for (int i = 0; i < steps; i++)
+                step(timestep.step);
+            if (steps > 0)
+            {
+                auto &snapshot = snapshots.back();
+                publish(snapshot);
+                snapshot.time = now();
+                snapshot.step = timestep.step;
+                snapshots.publish();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::duration<double>(timestep.step - timestep.accumulator));
+            }
+        }
+    }
+};
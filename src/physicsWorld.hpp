@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "broadphase.hpp"
+#include "physicsObject.hpp"
+#include "staticColliders.hpp"
+#include "threadPool.hpp"
+
+// Owns the rigid body step: broadphase, pairwise collision and integration.
+// Body state lives in the arrays of `state`; the RigidObjects are handles.
+// Touching bodies form islands; an island falls asleep once all its bodies
+// have been slow for timeToSleep, and wakes as a whole when one is woken.
+// Contacts are resolved by the ContactSolver from manifolds kept across
+// steps; useSolver = false falls back to one averaged impulse per contact.
+// Bodies moving more than ccdMotion leaves in a step are swept, so they
+// stop at what they would pass through instead of tunnelling.
+class PhysicsWorld
+{
+public:
+    std::vector<std::shared_ptr<RigidObject>> bodies;
+    RigidBodies state;
+    SweepAndPrune broadphase;
+    StaticColliderSet colliders; // the scene's planes and boxes
+    std::vector<std::pair<int, int>> pairs; // overlapping bounds of the last step
+    std::vector<std::pair<int, int>> contacts; // pairs whose octrees touched
+    bool sleeping = true;
+    float timeToSleep = 0.5f;
+    ThreadPool *pool = &ThreadPool::instance();
+    int pairsPerTask = 16;
+    std::vector<Vec3f> lastPos; // poses before the last step
+    std::vector<Quatf> lastQuat;
+    ContactSolver solver;
+    bool useSolver = true;
+    bool continuous = true;
+    float ccdMotion = 1; // in leaf sizes per step
+    int sweptBodies = 0; // swept in the last step
+
+    // the body's octree must be built, its nav and scale set
+    void addBody(std::shared_ptr<RigidObject> body, float mass = 300)
+    {
+        auto &q = body->nav.quat();
+        body->bodies = &state;
+        body->id = state.add(body->nav.pos(), Quatf(q.w, q.x, q.y, q.z), mass);
+        body->initIRef();
+        body->updateTransform();
+        Vec3f min, max;
+        body->worldAABB(min, max);
+        broadphase.add(min, max);
+        bodies.push_back(body);
+    }
+
+    void updateBroadphase()
+    {
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (!state.isAwake(i))
+                continue; // has not moved
+            Vec3f min, max;
+            bodies[i]->worldAABB(min, max);
+            broadphase.update(i, min, max);
+        }
+        broadphase.findPairs(pairs);
+    }
+
+    // both directions of every pair across the pool, each into its own slot;
+    // the impulses are then applied in pair order, so the result does not
+    // depend on the thread count
+    void narrowphase()
+    {
+        if (useSolver)
+        {
+            manifoldPhase();
+            return;
+        }
+        impulses.resize(pairs.size() * 2);
+        int tasks = (pairs.size() + pairsPerTask - 1) / pairsPerTask;
+        if (scratch.size() < tasks)
+            scratch.resize(tasks);
+        pool->parallelFor(tasks, [&](int task) {
+            auto &leafPairs = scratch[task].leafPairs;
+            auto &contactLeaves = scratch[task].contactLeaves;
+            auto &octreePairs = scratch[task].octreePairs;
+            int end = std::min<int>(pairs.size(), (task + 1) * pairsPerTask);
+            for (int p = task * pairsPerTask; p < end; p++)
+            {
+                auto &a = *bodies[pairs[p].first];
+                auto &b = *bodies[pairs[p].second];
+                impulses[p * 2] = ContactImpulse();
+                impulses[p * 2 + 1] = ContactImpulse();
+                if (!state.isAwake(a.id) && !state.isAwake(b.id))
+                    continue;
+                a.contactImpulse(b, leafPairs, contactLeaves, octreePairs, impulses[p * 2]);
+                b.contactImpulse(a, leafPairs, contactLeaves, octreePairs, impulses[p * 2 + 1]);
+            }
+        });
+
+        contacts.clear();
+        for (int p = 0; p < pairs.size(); p++)
+        {
+            impulses[p * 2].apply(state);
+            impulses[p * 2 + 1].apply(state);
+            if (impulses[p * 2].touching || impulses[p * 2 + 1].touching)
+                contacts.push_back(pairs[p]);
+        }
+    }
+
+    // one manifold per pair across the pool, each into its own slot, handed
+    // to the solver in pair order
+    void manifoldPhase()
+    {
+        solver.begin();
+        pairManifolds.resize(pairs.size());
+        int tasks = (pairs.size() + pairsPerTask - 1) / pairsPerTask;
+        if (scratch.size() < tasks)
+            scratch.resize(tasks);
+        pool->parallelFor(tasks, [&](int task) {
+            int end = std::min<int>(pairs.size(), (task + 1) * pairsPerTask);
+            for (int p = task * pairsPerTask; p < end; p++)
+            {
+                auto &a = *bodies[pairs[p].first];
+                auto &b = *bodies[pairs[p].second];
+                pairManifolds[p].count = 0;
+                if (!state.isAwake(a.id) && !state.isAwake(b.id))
+                    continue;
+                a.contactManifold(b, scratch[task].leafPairs, scratch[task].octreePairs, scratch[task].candidates,
+                                  pairManifolds[p]);
+            }
+        });
+
+        contacts.clear();
+        for (int p = 0; p < pairs.size(); p++)
+        {
+            if (pairManifolds[p].count == 0)
+                continue;
+            solver.manifolds.push_back(pairManifolds[p]);
+            contacts.push_back(pairs[p]);
+        }
+    }
+
+    // union the contacts into islands, wake every island with an awake body
+    void buildIslands()
+    {
+        islandParent.resize(bodies.size());
+        for (int i = 0; i < bodies.size(); i++)
+            islandParent[i] = i;
+        for (auto &contact : contacts)
+            islandParent[findIsland(contact.first)] = findIsland(contact.second);
+
+        islandFlag.assign(bodies.size(), 0);
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (state.isAwake(i))
+                islandFlag[findIsland(i)] = 1;
+        }
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (!state.isAwake(i) && islandFlag[findIsland(i)])
+                state.wake(i);
+        }
+    }
+
+    void integrate(float dt)
+    {
+        state.integrateVelocities(dt);
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (!state.isAwake(i))
+                continue;
+            if (useSolver)
+                bodies[i]->staticManifolds(colliders, solver.manifolds);
+            else
+                bodies[i]->collideStatic(colliders);
+        }
+        if (useSolver)
+            solver.solve(state, dt);
+        state.integratePositions(dt);
+        if (continuous)
+            sweepFastBodies(dt);
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (state.isAwake(i))
+                bodies[i]->syncNav();
+        }
+        state.updateSleepTime(dt);
+    }
+
+    // Motion clamping, run after integratePositions while nav still holds
+    // the pose at the start of the step. The motion of a fast body is
+    // sampled at most a leaf apart, and the body stops at the first sample
+    // where a point enters a static collider or its octree touches a body it
+    // was not touching already. Its velocity is kept, so the discrete
+    // contacts of the next step stop it. Others are tested where the step
+    // started, as the broadphase saw them.
+    void sweepFastBodies(float dt)
+    {
+        sweptBodies = 0;
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (!state.isAwake(i))
+                continue;
+            auto &body = *bodies[i];
+            float leaf = body.leafSize();
+            Vec3f start = body.worldPos, end = state.position(i);
+            float motion = (end - start).mag() + state.angularVelocity(i).mag() * dt * body.boundingRadius();
+            if (motion <= ccdMotion * leaf)
+                continue;
+            sweptBodies++;
+
+            auto &q = body.nav.quat();
+            Quatf startQuat(q.w, q.x, q.y, q.z), endQuat = state.orientation(i);
+            colliders.hits(body.worldPoints, sweepStartHits);
+
+            // bodies the sweep may reach
+            Vec3f min, max, endMin, endMax;
+            body.worldAABB(min, max);
+            body.nav.pos(end.x, end.y, end.z);
+            body.nav.quat() = Quatd(endQuat.w, endQuat.x, endQuat.y, endQuat.z);
+            body.worldAABB(endMin, endMax);
+            for (int k = 0; k < 3; k++)
+            {
+                min[k] = std::min(min[k], endMin[k]) - leaf;
+                max[k] = std::max(max[k], endMax[k]) + leaf;
+            }
+            sweepBodies.clear();
+            for (int j = 0; j < bodies.size(); j++)
+            {
+                Vec3f otherMin, otherMax;
+                broadphase.bounds(j, otherMin, otherMax);
+                if (j == i || otherMin.x > max.x || otherMax.x < min.x || otherMin.y > max.y ||
+                    otherMax.y < min.y || otherMin.z > max.z || otherMax.z < min.z)
+                    continue;
+                bool touching = false;
+                for (auto &contact : contacts)
+                    touching |= (contact.first == i && contact.second == j) || (contact.first == j && contact.second == i);
+                if (!touching)
+                    sweepBodies.push_back(j);
+            }
+
+            int samples = std::ceil(motion / leaf);
+            for (int k = 1; k <= samples; k++)
+            {
+                float f = (float)k / samples;
+                Vec3f pos = start + (end - start) * f;
+                Quatf rot = Quatf::slerp(startQuat, endQuat, f);
+                body.nav.pos(pos.x, pos.y, pos.z);
+                body.nav.quat() = Quatd(rot.w, rot.x, rot.y, rot.z);
+                body.updateTransform();
+
+                colliders.hits(body.worldPoints, sweepHits);
+                bool hit = !std::includes(sweepStartHits.begin(), sweepStartHits.end(), sweepHits.begin(),
+                                          sweepHits.end());
+                for (int n = 0; n < sweepBodies.size() && !hit; n++)
+                {
+                    body.touchingLeaves(*bodies[sweepBodies[n]], sweepLeafPairs, sweepOctreePairs, true);
+                    hit = !sweepLeafPairs.empty();
+                }
+                if (hit)
+                {
+                    state.px[i] = pos.x;
+                    state.py[i] = pos.y;
+                    state.pz[i] = pos.z;
+                    state.qw[i] = rot.w;
+                    state.qx[i] = rot.x;
+                    state.qy[i] = rot.y;
+                    state.qz[i] = rot.z;
+                    break;
+                }
+            }
+            // back to the start, later sweeps test against it there
+            body.nav.pos(start.x, start.y, start.z);
+            body.nav.quat() = Quatd(startQuat.w, startQuat.x, startQuat.y, startQuat.z);
+            body.updateTransform();
+        }
+    }
+
+    // islands whose bodies have all rested long enough go to sleep together
+    void updateSleep()
+    {
+        if (!sleeping)
+            return;
+        islandFlag.assign(bodies.size(), 1);
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (state.isAwake(i) && state.sleepTime[i] < timeToSleep)
+                islandFlag[findIsland(i)] = 0;
+        }
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (state.isAwake(i) && islandFlag[findIsland(i)])
+                state.sleep(i);
+        }
+    }
+
+    int awakeCount() const
+    {
+        int count = 0;
+        for (int i = 0; i < bodies.size(); i++)
+            count += state.isAwake(i);
+        return count;
+    }
+
+    void step(float dt)
+    {
+        lastPos.resize(bodies.size());
+        lastQuat.resize(bodies.size());
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            lastPos[i] = state.position(i);
+            lastQuat[i] = state.orientation(i);
+        }
+        updateBroadphase();
+        narrowphase();
+        buildIslands();
+        integrate(dt);
+        updateSleep();
+    }
+
+private:
+    struct NarrowphaseScratch
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> leafPairs;
+        std::vector<uint32_t> contactLeaves;
+        OctreePairScratch octreePairs;
+        std::vector<ContactPoint> candidates;
+    };
+    std::vector<ContactImpulse> impulses; // two per pair
+    std::vector<ContactManifold> pairManifolds; // one per pair
+    std::vector<uint32_t> sweepStartHits, sweepHits; // scratch of sweepFastBodies
+    std::vector<int> sweepBodies;
+    std::vector<std::pair<uint32_t, uint32_t>> sweepLeafPairs;
+    OctreePairScratch sweepOctreePairs;
+    std::vector<NarrowphaseScratch> scratch; // one per task
+
+    std::vector<int> islandParent;
+    std::vector<char> islandFlag;
+
+    int findIsland(int i)
+    {
+        while (islandParent[i] != i)
+        {
+            islandParent[i] = islandParent[islandParent[i]];
+            i = islandParent[i];
+        }
+        return i;
+    }
+};
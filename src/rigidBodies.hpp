@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "al/math/al_Mat.hpp"
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "simd.hpp"
+
+using namespace al;
+
+// State of every rigid body of a PhysicsWorld as structure of arrays, one
+// slot per body. The integration kernels run over all slots in SIMD batches
+// and finish the tail (or everything, without SIMD) with the scalar loop.
+// Asleep bodies have zero velocities and awake = 0, so they pass through the
+// kernels unchanged.
+struct RigidBodies
+{
+    std::vector<float> px, py, pz;
+    std::vector<float> qw, qx, qy, qz;
+    std::vector<float> vx, vy, vz;     // velocity
+    std::vector<float> wx, wy, wz;     // angular velocity
+    std::vector<float> dvx, dvy, dvz;  // velocity changes collected in the step
+    std::vector<float> dwx, dwy, dwz;
+    std::vector<float> mass, linearDecay, angularDecay, g;
+    std::vector<float> restitution, miu_t;
+    std::vector<float> awake, sleepTime;
+    std::vector<Mat4f> I_ref, I_refInverse; // inertia matrix
+    float sleepLinear = 0.2f;
+    float sleepAngular = 0.2f;
+    bool vectorized = true; // false runs the scalar loops only, for comparison
+
+    int size() const { return px.size(); }
+
+    int add(Vec3f pos, Quatf q, float _mass = 300)
+    {
+        for (auto array : {&vx, &vy, &vz, &wx, &wy, &wz, &dvx, &dvy, &dvz, &dwx, &dwy, &dwz, &sleepTime})
+            array->push_back(0);
+        px.push_back(pos.x);
+        py.push_back(pos.y);
+        pz.push_back(pos.z);
+        qw.push_back(q.w);
+        qx.push_back(q.x);
+        qy.push_back(q.y);
+        qz.push_back(q.z);
+        mass.push_back(_mass);
+        linearDecay.push_back(0.999f);
+        angularDecay.push_back(0.98f);
+        g.push_back(9.8f);
+        restitution.push_back(0.5f);
+        miu_t.push_back(0.7f);
+        awake.push_back(1);
+        I_ref.push_back(Mat4f::identity());
+        I_refInverse.push_back(Mat4f::identity());
+        return size() - 1;
+    }
+
+    Vec3f position(int i) const { return Vec3f(px[i], py[i], pz[i]); }
+    Quatf orientation(int i) const { return Quatf(qw[i], qx[i], qy[i], qz[i]); }
+    Vec3f velocity(int i) const { return Vec3f(vx[i], vy[i], vz[i]); }
+    Vec3f angularVelocity(int i) const { return Vec3f(wx[i], wy[i], wz[i]); }
+
+    void velocity(int i, Vec3f v)
+    {
+        vx[i] = v.x;
+        vy[i] = v.y;
+        vz[i] = v.z;
+    }
+
+    void angularVelocity(int i, Vec3f w)
+    {
+        wx[i] = w.x;
+        wy[i] = w.y;
+        wz[i] = w.z;
+    }
+
+    void addDelta(int i, Vec3f dv, Vec3f dw)
+    {
+        dvx[i] += dv.x;
+        dvy[i] += dv.y;
+        dvz[i] += dv.z;
+        dwx[i] += dw.x;
+        dwy[i] += dw.y;
+        dwz[i] += dw.z;
+    }
+
+    bool isAwake(int i) const { return awake[i] != 0; }
+
+    void wake(int i)
+    {
+        awake[i] = 1;
+        sleepTime[i] = 0;
+    }
+
+    void sleep(int i)
+    {
+        awake[i] = 0;
+        for (auto array : {&vx, &vy, &vz, &wx, &wy, &wz, &dvx, &dvy, &dvz, &dwx, &dwy, &dwz})
+            (*array)[i] = 0;
+    }
+
+    // damping and gravity
+    void integrateVelocities(float dt)
+    {
+        int n = size(), i = 0;
+#ifdef SIMD_WIDTH
+        if (vectorized)
+        {
+            simdf t = simdSet(dt);
+            for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+            {
+                simdf ld = simdLoad(&linearDecay[i]);
+                simdf ad = simdLoad(&angularDecay[i]);
+                simdf fall = simdMul(simdMul(t, simdLoad(&g[i])), simdLoad(&awake[i]));
+                simdStore(&vx[i], simdMul(simdLoad(&vx[i]), ld));
+                simdStore(&vy[i], simdSub(simdMul(simdLoad(&vy[i]), ld), fall));
+                simdStore(&vz[i], simdMul(simdLoad(&vz[i]), ld));
+                simdStore(&wx[i], simdMul(simdLoad(&wx[i]), ad));
+                simdStore(&wy[i], simdMul(simdLoad(&wy[i]), ad));
+                simdStore(&wz[i], simdMul(simdLoad(&wz[i]), ad));
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            float fall = dt * g[i] * awake[i];
+            vx[i] = vx[i] * linearDecay[i];
+            vy[i] = vy[i] * linearDecay[i] - fall;
+            vz[i] = vz[i] * linearDecay[i];
+            wx[i] = wx[i] * angularDecay[i];
+            wy[i] = wy[i] * angularDecay[i];
+            wz[i] = wz[i] * angularDecay[i];
+        }
+    }
+
+    // applies the collected changes, then moves and rotates by the velocities
+    void integratePositions(float dt)
+    {
+        int n = size(), i = 0;
+#ifdef SIMD_WIDTH
+        if (vectorized)
+        {
+            simdf t = simdSet(dt), h = simdSet(dt * 0.5f), zero = simdSet(0), one = simdSet(1);
+            for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+            {
+                simdf _vx = simdAdd(simdLoad(&vx[i]), simdLoad(&dvx[i]));
+                simdf _vy = simdAdd(simdLoad(&vy[i]), simdLoad(&dvy[i]));
+                simdf _vz = simdAdd(simdLoad(&vz[i]), simdLoad(&dvz[i]));
+                simdf _wx = simdAdd(simdLoad(&wx[i]), simdLoad(&dwx[i]));
+                simdf _wy = simdAdd(simdLoad(&wy[i]), simdLoad(&dwy[i]));
+                simdf _wz = simdAdd(simdLoad(&wz[i]), simdLoad(&dwz[i]));
+                simdStore(&vx[i], _vx);
+                simdStore(&vy[i], _vy);
+                simdStore(&vz[i], _vz);
+                simdStore(&wx[i], _wx);
+                simdStore(&wy[i], _wy);
+                simdStore(&wz[i], _wz);
+                for (auto array : {&dvx, &dvy, &dvz, &dwx, &dwy, &dwz})
+                    simdStore(&(*array)[i], zero);
+
+                simdStore(&px[i], simdAdd(simdLoad(&px[i]), simdMul(t, _vx)));
+                simdStore(&py[i], simdAdd(simdLoad(&py[i]), simdMul(t, _vy)));
+                simdStore(&pz[i], simdAdd(simdLoad(&pz[i]), simdMul(t, _vz)));
+
+                // q += (0, w * dt / 2) * q
+                simdf ax = simdMul(_wx, h), ay = simdMul(_wy, h), az = simdMul(_wz, h);
+                simdf _qw = simdLoad(&qw[i]), _qx = simdLoad(&qx[i]), _qy = simdLoad(&qy[i]), _qz = simdLoad(&qz[i]);
+                simdf nw = simdSub(simdSub(simdSub(_qw, simdMul(ax, _qx)), simdMul(ay, _qy)), simdMul(az, _qz));
+                simdf nx = simdSub(simdAdd(simdAdd(_qx, simdMul(ax, _qw)), simdMul(ay, _qz)), simdMul(az, _qy));
+                simdf ny = simdAdd(simdAdd(simdSub(_qy, simdMul(ax, _qz)), simdMul(ay, _qw)), simdMul(az, _qx));
+                simdf nz = simdAdd(simdSub(simdAdd(_qz, simdMul(ax, _qy)), simdMul(ay, _qx)), simdMul(az, _qw));
+                simdf mag = simdAdd(simdAdd(simdMul(nw, nw), simdMul(nx, nx)), simdAdd(simdMul(ny, ny), simdMul(nz, nz)));
+                simdf inv = simdDiv(one, simdSqrt(mag));
+                simdStore(&qw[i], simdMul(nw, inv));
+                simdStore(&qx[i], simdMul(nx, inv));
+                simdStore(&qy[i], simdMul(ny, inv));
+                simdStore(&qz[i], simdMul(nz, inv));
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            vx[i] = vx[i] + dvx[i];
+            vy[i] = vy[i] + dvy[i];
+            vz[i] = vz[i] + dvz[i];
+            wx[i] = wx[i] + dwx[i];
+            wy[i] = wy[i] + dwy[i];
+            wz[i] = wz[i] + dwz[i];
+            dvx[i] = dvy[i] = dvz[i] = 0;
+            dwx[i] = dwy[i] = dwz[i] = 0;
+
+            px[i] = px[i] + dt * vx[i];
+            py[i] = py[i] + dt * vy[i];
+            pz[i] = pz[i] + dt * vz[i];
+
+            float h = dt * 0.5f;
+            float ax = wx[i] * h, ay = wy[i] * h, az = wz[i] * h;
+            float nw = qw[i] - ax * qx[i] - ay * qy[i] - az * qz[i];
+            float nx = qx[i] + ax * qw[i] + ay * qz[i] - az * qy[i];
+            float ny = qy[i] - ax * qz[i] + ay * qw[i] + az * qx[i];
+            float nz = qz[i] + ax * qy[i] - ay * qx[i] + az * qw[i];
+            float inv = 1 / sqrtf((nw * nw + nx * nx) + (ny * ny + nz * nz));
+            qw[i] = nw * inv;
+            qx[i] = nx * inv;
+            qy[i] = ny * inv;
+            qz[i] = nz * inv;
+        }
+    }
+
+    // time spent under both sleep thresholds
+    void updateSleepTime(float dt)
+    {
+        int n = size(), i = 0;
+        float linear2 = sleepLinear * sleepLinear, angular2 = sleepAngular * sleepAngular;
+#ifdef SIMD_WIDTH
+        if (vectorized)
+        {
+            simdf t = simdSet(dt), lin = simdSet(linear2), ang = simdSet(angular2), zero = simdSet(0);
+            for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+            {
+                simdf _vx = simdLoad(&vx[i]), _vy = simdLoad(&vy[i]), _vz = simdLoad(&vz[i]);
+                simdf _wx = simdLoad(&wx[i]), _wy = simdLoad(&wy[i]), _wz = simdLoad(&wz[i]);
+                simdf v2 = simdAdd(simdAdd(simdMul(_vx, _vx), simdMul(_vy, _vy)), simdMul(_vz, _vz));
+                simdf w2 = simdAdd(simdAdd(simdMul(_wx, _wx), simdMul(_wy, _wy)), simdMul(_wz, _wz));
+                simdf slow = simdAnd(simdLess(v2, lin), simdLess(w2, ang));
+                simdStore(&sleepTime[i], simdSelect(slow, simdAdd(simdLoad(&sleepTime[i]), t), zero));
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            float v2 = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+            float w2 = wx[i] * wx[i] + wy[i] * wy[i] + wz[i] * wz[i];
+            sleepTime[i] = (v2 < linear2 && w2 < angular2) ? sleepTime[i] + dt : 0;
+        }
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+// Thin wrappers over the widest float vector the target was compiled for:
+// AVX (8 lanes) with -mavx or -march=native, SSE2 (4 lanes) on any x86-64.
+// Other targets (e.g. ARM Macs) define no SIMD_WIDTH and the callers keep
+// only their scalar loops.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 simdf;
+inline simdf simdLoad(const float *p) { return _mm256_loadu_ps(p); }
+inline void simdStore(float *p, simdf a) { _mm256_storeu_ps(p, a); }
+inline simdf simdSet(float a) { return _mm256_set1_ps(a); }
+inline simdf simdAdd(simdf a, simdf b) { return _mm256_add_ps(a, b); }
+inline simdf simdSub(simdf a, simdf b) { return _mm256_sub_ps(a, b); }
+inline simdf simdMul(simdf a, simdf b) { return _mm256_mul_ps(a, b); }
+inline simdf simdDiv(simdf a, simdf b) { return _mm256_div_ps(a, b); }
+inline simdf simdSqrt(simdf a) { return _mm256_sqrt_ps(a); }
+inline simdf simdRsqrt(simdf a) { return _mm256_rsqrt_ps(a); } // 12 bits
+inline simdf simdMin(simdf a, simdf b) { return _mm256_min_ps(a, b); }
+inline simdf simdMax(simdf a, simdf b) { return _mm256_max_ps(a, b); }
+inline simdf simdLess(simdf a, simdf b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline simdf simdAnd(simdf a, simdf b) { return _mm256_and_ps(a, b); }
+inline simdf simdOr(simdf a, simdf b) { return _mm256_or_ps(a, b); }
+inline simdf simdSelect(simdf mask, simdf a, simdf b) { return _mm256_blendv_ps(b, a, mask); }
+inline int simdMask(simdf a) { return _mm256_movemask_ps(a); }
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 simdf;
+inline simdf simdLoad(const float *p) { return _mm_loadu_ps(p); }
+inline void simdStore(float *p, simdf a) { _mm_storeu_ps(p, a); }
+inline simdf simdSet(float a) { return _mm_set1_ps(a); }
+inline simdf simdAdd(simdf a, simdf b) { return _mm_add_ps(a, b); }
+inline simdf simdSub(simdf a, simdf b) { return _mm_sub_ps(a, b); }
+inline simdf simdMul(simdf a, simdf b) { return _mm_mul_ps(a, b); }
+inline simdf simdDiv(simdf a, simdf b) { return _mm_div_ps(a, b); }
+inline simdf simdSqrt(simdf a) { return _mm_sqrt_ps(a); }
+inline simdf simdRsqrt(simdf a) { return _mm_rsqrt_ps(a); } // 12 bits
+inline simdf simdMin(simdf a, simdf b) { return _mm_min_ps(a, b); }
+inline simdf simdMax(simdf a, simdf b) { return _mm_max_ps(a, b); }
+inline simdf simdLess(simdf a, simdf b) { return _mm_cmplt_ps(a, b); }
+inline simdf simdAnd(simdf a, simdf b) { return _mm_and_ps(a, b); }
+inline simdf simdOr(simdf a, simdf b) { return _mm_or_ps(a, b); }
+inline simdf simdSelect(simdf mask, simdf a, simdf b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int simdMask(simdf a) { return _mm_movemask_ps(a); }
+#endif
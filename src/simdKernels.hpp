@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "al/math/al_Mat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "simd.hpp"
+
+using namespace al;
+
+// Point set as structure of arrays, the layout the batch kernels below read.
+struct PointBuffer
+{
+    std::vector<float> x, y, z;
+
+    int size() const { return x.size(); }
+
+    void resize(int n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+
+    void set(int i, const Vec3f &p)
+    {
+        x[i] = p.x;
+        y[i] = p.y;
+        z[i] = p.z;
+    }
+
+    Vec3f get(int i) const { return Vec3f(x[i], y[i], z[i]); }
+
+    void assign(const std::vector<Vec3f> &points)
+    {
+        resize(points.size());
+        for (int i = 0; i < points.size(); i++)
+            set(i, points[i]);
+    }
+};
+
+// Each kernel has a scalar reference version, which the SIMD version also
+// uses for the points past the last full batch.
+
+// out = M * (p, 1), only the upper 3x4 of M is read
+void transformPointsScalar(const Mat4f &M, const PointBuffer &in, PointBuffer &out, int begin = 0)
+{
+    out.resize(in.size());
+    for (int i = begin; i < in.size(); i++)
+    {
+        float x = in.x[i], y = in.y[i], z = in.z[i];
+        out.x[i] = M(0, 0) * x + M(0, 1) * y + M(0, 2) * z + M(0, 3);
+        out.y[i] = M(1, 0) * x + M(1, 1) * y + M(1, 2) * z + M(1, 3);
+        out.z[i] = M(2, 0) * x + M(2, 1) * y + M(2, 2) * z + M(2, 3);
+    }
+}
+
+void transformPoints(const Mat4f &M, const PointBuffer &in, PointBuffer &out)
+{
+    out.resize(in.size());
+    int i = 0;
+#ifdef SIMD_WIDTH
+    simdf m[12];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            m[r * 4 + c] = simdSet(M(r, c));
+    for (; i + SIMD_WIDTH <= in.size(); i += SIMD_WIDTH)
+    {
+        simdf x = simdLoad(&in.x[i]), y = simdLoad(&in.y[i]), z = simdLoad(&in.z[i]);
+        simdStore(&out.x[i], simdAdd(simdAdd(simdAdd(simdMul(m[0], x), simdMul(m[1], y)), simdMul(m[2], z)), m[3]));
+        simdStore(&out.y[i], simdAdd(simdAdd(simdAdd(simdMul(m[4], x), simdMul(m[5], y)), simdMul(m[6], z)), m[7]));
+        simdStore(&out.z[i], simdAdd(simdAdd(simdAdd(simdMul(m[8], x), simdMul(m[9], y)), simdMul(m[10], z)), m[11]));
+    }
+#endif
+    transformPointsScalar(M, in, out, i);
+}
+
+// signed distance of every point to the plane through P with unit normal N
+void planeDistancesScalar(const PointBuffer &points, Vec3f P, Vec3f N, std::vector<float> &d, int begin = 0)
+{
+    d.resize(points.size());
+    for (int i = begin; i < points.size(); i++)
+    {
+        d[i] = (points.x[i] - P.x) * N.x + (points.y[i] - P.y) * N.y + (points.z[i] - P.z) * N.z;
+    }
+}
+
+void planeDistances(const PointBuffer &points, Vec3f P, Vec3f N, std::vector<float> &d)
+{
+    d.resize(points.size());
+    int i = 0;
+#ifdef SIMD_WIDTH
+    simdf px = simdSet(P.x), py = simdSet(P.y), pz = simdSet(P.z);
+    simdf nx = simdSet(N.x), ny = simdSet(N.y), nz = simdSet(N.z);
+    for (; i + SIMD_WIDTH <= points.size(); i += SIMD_WIDTH)
+    {
+        simdf dx = simdMul(simdSub(simdLoad(&points.x[i]), px), nx);
+        simdf dy = simdMul(simdSub(simdLoad(&points.y[i]), py), ny);
+        simdf dz = simdMul(simdSub(simdLoad(&points.z[i]), pz), nz);
+        simdStore(&d[i], simdAdd(simdAdd(dx, dy), dz));
+    }
+#endif
+    planeDistancesScalar(points, P, N, d, i);
+}
+
+// whether M * (p, 1) of point i is strictly inside [min, max], as inBox
+inline bool pointInBox(const Mat4f &M, const PointBuffer &points, int i, const Vec3f &min, const Vec3f &max)
+{
+    float x = points.x[i], y = points.y[i], z = points.z[i];
+    float lx = M(0, 0) * x + M(0, 1) * y + M(0, 2) * z + M(0, 3);
+    float ly = M(1, 0) * x + M(1, 1) * y + M(1, 2) * z + M(1, 3);
+    float lz = M(2, 0) * x + M(2, 1) * y + M(2, 2) * z + M(2, 3);
+    return min.x < lx && lx < max.x && min.y < ly && ly < max.y && min.z < lz && lz < max.z;
+}
+
+#ifdef SIMD_WIDTH
+// the same test for SIMD_WIDTH points from i, one bit per lane
+struct BoxLanes
+{
+    simdf m[12];
+    simdf min[3], max[3];
+
+    BoxLanes(const Mat4f &M, const Vec3f &_min, const Vec3f &_max)
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+                m[r * 4 + c] = simdSet(M(r, c));
+            min[r] = simdSet(_min[r]);
+            max[r] = simdSet(_max[r]);
+        }
+    }
+
+    int bits(const PointBuffer &points, int i) const
+    {
+        simdf x = simdLoad(&points.x[i]), y = simdLoad(&points.y[i]), z = simdLoad(&points.z[i]);
+        simdf in = simdSet(0);
+        for (int r = 0; r < 3; r++)
+        {
+            simdf l = simdAdd(simdAdd(simdAdd(simdMul(m[r * 4], x), simdMul(m[r * 4 + 1], y)),
+                                      simdMul(m[r * 4 + 2], z)), m[r * 4 + 3]);
+            simdf axis = simdAnd(simdLess(min[r], l), simdLess(l, max[r]));
+            in = r == 0 ? axis : simdAnd(in, axis);
+        }
+        return simdMask(in);
+    }
+};
+#endif
+
+// indices of the points inside the oriented box whose local frame M maps
+// to, in ascending order; returns the count
+int pointsInBoxScalar(const Mat4f &M, const PointBuffer &points, Vec3f min, Vec3f max,
+                      std::vector<uint32_t> &inside, int begin = 0, int count = 0)
+{
+    inside.resize(points.size());
+    for (int i = begin; i < points.size(); i++)
+    {
+        if (pointInBox(M, points, i, min, max))
+            inside[count++] = i;
+    }
+    inside.resize(count);
+    return count;
+}
+
+int pointsInBox(const Mat4f &M, const PointBuffer &points, Vec3f min, Vec3f max, std::vector<uint32_t> &inside)
+{
+    inside.resize(points.size());
+    int i = 0, count = 0;
+#ifdef SIMD_WIDTH
+    BoxLanes lanes(M, min, max);
+    for (; i + SIMD_WIDTH <= points.size(); i += SIMD_WIDTH)
+    {
+        // compact the set lanes without branching
+        int bits = lanes.bits(points, i);
+        for (int k = 0; k < SIMD_WIDTH; k++)
+        {
+            inside[count] = i + k;
+            count += bits >> k & 1;
+        }
+    }
+#endif
+    return pointsInBoxScalar(M, points, min, max, inside, i, count);
+}
+
+// the same test as a 0/1 mask per point
+void pointsInBoxMask(const Mat4f &M, const PointBuffer &points, Vec3f min, Vec3f max, std::vector<uint8_t> &mask)
+{
+    mask.resize(points.size());
+    int i = 0;
+#ifdef SIMD_WIDTH
+    BoxLanes lanes(M, min, max);
+    for (; i + SIMD_WIDTH <= points.size(); i += SIMD_WIDTH)
+    {
+        int bits = lanes.bits(points, i);
+        for (int k = 0; k < SIMD_WIDTH; k++)
+            mask[i + k] = bits >> k & 1;
+    }
+#endif
+    for (; i < points.size(); i++)
+        mask[i] = pointInBox(M, points, i, min, max);
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "simd.hpp"
+
+// Reverse Cuthill-McKee: numbers the nodes of a graph breadth first from a
+// node far out on it, neighbors of fewer neighbors first, then reverses the
+// numbering. Neighbors end up with nearby numbers, so a matrix with the
+// graph as its pattern has a narrow envelope. The neighbors of node i are
+// neighbors[start[i]] up to start[i + 1]; row[i] is the new number of i.
+void reverseCuthillMcKee(const std::vector<int> &start, const std::vector<int> &neighbors, std::vector<int> &row)
+{
+    int n = start.size() - 1;
+    auto degree = [&](int i) { return start[i + 1] - start[i]; };
+    std::vector<int> order, level(n);
+    std::vector<bool> numbered(n, false);
+    // breadth first from root over the nodes not numbered yet, appending to
+    // order; returns the first node of the last level
+    auto visit = [&](int root, std::vector<int> &order, std::vector<bool> &seen) {
+        int first = order.size();
+        order.push_back(root);
+        seen[root] = true;
+        level[root] = 0;
+        int last = root;
+        for (int q = first; q < order.size(); q++)
+        {
+            int i = order[q];
+            if (level[i] > level[last])
+                last = i;
+            int begin = order.size();
+            for (int k = start[i]; k < start[i + 1]; k++)
+            {
+                int j = neighbors[k];
+                if (!seen[j])
+                {
+                    seen[j] = true;
+                    level[j] = level[i] + 1;
+                    order.push_back(j);
+                }
+            }
+            std::sort(order.begin() + begin, order.end(),
+                      [&](int a, int b) { return degree(a) < degree(b) || (degree(a) == degree(b) && a < b); });
+        }
+        return last;
+    };
+
+    std::vector<int> trial;
+    for (int i = 0; i < n; i++)
+    {
+        if (numbered[i])
+            continue;
+        // each component from a pseudo-peripheral node: start at its node of
+        // fewest neighbors, move to the far end while that gets farther
+        int root = i;
+        for (int q = i; q < n; q++)
+        {
+            if (!numbered[q] && degree(q) < degree(root))
+                root = q;
+        }
+        int depth = -1;
+        for (int pass = 0; pass < 4; pass++)
+        {
+            trial.clear();
+            std::vector<bool> seen = numbered;
+            int far = visit(root, trial, seen);
+            if (level[far] <= depth)
+                break;
+            depth = level[far];
+            root = far;
+        }
+        visit(root, order, numbered);
+    }
+    row.resize(n);
+    for (int q = 0; q < n; q++)
+        row[order[q]] = n - 1 - q;
+}
+
+// Cholesky factor L (A = L L^T) of a sparse symmetric positive definite
+// matrix in envelope (skyline) form: row i keeps its entries from its first
+// nonzero column first[i] up to the diagonal, the only places the factor
+// fills in. Rows and their dot products are contiguous, so factoring is
+// dense loops over the envelope and a solve is one pass down and one back
+// up it, for three right hand sides at once.
+class SkylineCholesky
+{
+public:
+    struct Entry
+    {
+        int i, j; // row and column, either triangle, each pair once
+        double value;
+    };
+
+    std::vector<int> first;
+    std::vector<size_t> start; // row i is values[start[i]] up to its diagonal at start[i + 1] - 1
+    std::vector<float> values;
+
+    int size() const { return first.size(); }
+    size_t memoryBytes() const { return values.size() * sizeof(float) + first.size() * (sizeof(int) + sizeof(size_t)); }
+
+    // false when A is not positive definite
+    bool factor(const std::vector<double> &diagonal, const std::vector<Entry> &entries)
+    {
+        int n = diagonal.size();
+        first.resize(n);
+        for (int i = 0; i < n; i++)
+            first[i] = i;
+        for (auto &e : entries)
+        {
+            int i = std::max(e.i, e.j), j = std::min(e.i, e.j);
+            first[i] = std::min(first[i], j);
+        }
+        start.resize(n + 1);
+        start[0] = 0;
+        for (int i = 0; i < n; i++)
+            start[i + 1] = start[i] + i - first[i] + 1;
+        values.assign(start[n], 0);
+        for (int i = 0; i < n; i++)
+            at(i, i) = diagonal[i];
+        for (auto &e : entries)
+            at(std::max(e.i, e.j), std::min(e.i, e.j)) = e.value;
+
+        for (int i = 0; i < n; i++)
+        {
+            float *Li = &values[start[i]] - first[i]; // Li[j] is L(i, j)
+            for (int j = first[i]; j < i; j++)
+            {
+                const float *Lj = &values[start[j]] - first[j];
+                int k = std::max(first[i], first[j]);
+                double s = Li[j];
+                for (; k < j; k++)
+                    s -= (double)Li[k] * Lj[k];
+                Li[j] = s / Lj[j];
+            }
+            double d = Li[i];
+            for (int k = first[i]; k < i; k++)
+                d -= (double)Li[k] * Li[k];
+            if (!(d > 0))
+                return false;
+            Li[i] = sqrt(d);
+        }
+        return true;
+    }
+
+    // solves A v = b for v = (x, y, z) in place of b
+    void solve(float *x, float *y, float *z) const
+    {
+        int n = size();
+        // L w = b, row by row
+        for (int i = 0; i < n; i++)
+        {
+            const float *Li = &values[start[i]];
+            int count = i - first[i];
+            const float *wx = x + first[i], *wy = y + first[i], *wz = z + first[i];
+            float sx = 0, sy = 0, sz = 0;
+            int k = 0;
+#ifdef SIMD_WIDTH
+            simdf ax = simdSet(0), ay = simdSet(0), az = simdSet(0);
+            for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH)
+            {
+                simdf l = simdLoad(Li + k);
+                ax = simdAdd(ax, simdMul(l, simdLoad(wx + k)));
+                ay = simdAdd(ay, simdMul(l, simdLoad(wy + k)));
+                az = simdAdd(az, simdMul(l, simdLoad(wz + k)));
+            }
+            alignas(32) float lanes[3][SIMD_WIDTH];
+            simdStore(lanes[0], ax);
+            simdStore(lanes[1], ay);
+            simdStore(lanes[2], az);
+            for (int l = 0; l < SIMD_WIDTH; l++)
+            {
+                sx += lanes[0][l];
+                sy += lanes[1][l];
+                sz += lanes[2][l];
+            }
+#endif
+            for (; k < count; k++)
+            {
+                sx += Li[k] * wx[k];
+                sy += Li[k] * wy[k];
+                sz += Li[k] * wz[k];
+            }
+            float d = Li[count];
+            x[i] = (x[i] - sx) / d;
+            y[i] = (y[i] - sy) / d;
+            z[i] = (z[i] - sz) / d;
+        }
+        // L^T v = w, column by column from the last
+        for (int i = n - 1; i >= 0; i--)
+        {
+            const float *Li = &values[start[i]];
+            int count = i - first[i];
+            float d = Li[count];
+            float vx = x[i] /= d, vy = y[i] /= d, vz = z[i] /= d;
+            float *wx = x + first[i], *wy = y + first[i], *wz = z + first[i];
+            int k = 0;
+#ifdef SIMD_WIDTH
+            simdf bx = simdSet(vx), by = simdSet(vy), bz = simdSet(vz);
+            for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH)
+            {
+                simdf l = simdLoad(Li + k);
+                simdStore(wx + k, simdSub(simdLoad(wx + k), simdMul(l, bx)));
+                simdStore(wy + k, simdSub(simdLoad(wy + k), simdMul(l, by)));
+                simdStore(wz + k, simdSub(simdLoad(wz + k), simdMul(l, bz)));
+            }
+#endif
+            for (; k < count; k++)
+            {
+                wx[k] -= Li[k] * vx;
+                wy[k] -= Li[k] * vy;
+                wz[k] -= Li[k] * vz;
+            }
+        }
+    }
+
+private:
+    float &at(int i, int j) { return values[start[i] + j - first[i]]; }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "al/math/al_Vec.hpp"
+
+using namespace al;
+
+// Uniform grid over a point set, hashed into a table so it needs no bounds.
+// build is a counting sort of the point indices by bucket, linear in the
+// number of points; buckets store their points contiguously. Queries see the
+// cells the points were in at build time, moving points afterwards is fine.
+class SpatialHash
+{
+public:
+    struct Cell
+    {
+        int x, y, z;
+    };
+
+    float cellSize = 0.5f;
+    std::vector<uint32_t> bucketStart; // size buckets + 1
+    std::vector<uint32_t> entries;     // point indices grouped by bucket
+    std::vector<Cell> pointCell;
+
+    void build(const std::vector<Vec3f> &_points, float _cellSize)
+    {
+        cellSize = _cellSize;
+        uint32_t buckets = 1;
+        while (buckets < 2 * _points.size())
+            buckets <<= 1;
+        mask = buckets - 1;
+
+        bucketStart.assign(buckets + 1, 0);
+        pointCell.resize(_points.size());
+        for (uint32_t i = 0; i < _points.size(); i++)
+        {
+            pointCell[i] = cell(_points[i]);
+            bucketStart[hash(pointCell[i])]++;
+        }
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < buckets; b++)
+        {
+            uint32_t count = bucketStart[b];
+            bucketStart[b] = sum;
+            sum += count;
+        }
+        // each start moves to its bucket's end while filling, shift them back
+        entries.resize(_points.size());
+        for (uint32_t i = 0; i < _points.size(); i++)
+            entries[bucketStart[hash(pointCell[i])]++] = i;
+        for (uint32_t b = buckets; b > 0; b--)
+            bucketStart[b] = bucketStart[b - 1];
+        bucketStart[0] = 0;
+    }
+
+    // fn(i) once for every point whose cell touches [min, max]; the caller
+    // still tests the point itself
+    template <class F>
+    void query(Vec3f min, Vec3f max, F fn) const
+    {
+        if (entries.empty())
+            return;
+        Cell lo = cell(min), hi = cell(max);
+        double cells = (double)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1);
+        if (cells > entries.size())
+        {
+            // box covers more cells than there are points
+            for (uint32_t i = 0; i < pointCell.size(); i++)
+            {
+                const Cell &pc = pointCell[i];
+                if (pc.x >= lo.x && pc.x <= hi.x && pc.y >= lo.y && pc.y <= hi.y && pc.z >= lo.z && pc.z <= hi.z)
+                    fn(i);
+            }
+            return;
+        }
+        for (int z = lo.z; z <= hi.z; z++)
+        {
+            for (int y = lo.y; y <= hi.y; y++)
+            {
+                for (int x = lo.x; x <= hi.x; x++)
+                {
+                    Cell c{x, y, z};
+                    uint32_t b = hash(c);
+                    for (uint32_t e = bucketStart[b]; e < bucketStart[b + 1]; e++)
+                    {
+                        // other cells can share the bucket
+                        uint32_t i = entries[e];
+                        const Cell &pc = pointCell[i];
+                        if (pc.x == x && pc.y == y && pc.z == z)
+                            fn(i);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    Cell cell(const Vec3f &p) const
+    {
+        return {(int)floorf(p.x / cellSize), (int)floorf(p.y / cellSize), (int)floorf(p.z / cellSize)};
+    }
+
+    uint32_t hash(const Cell &c) const
+    {
+        return ((uint32_t)c.x * 73856093u ^ (uint32_t)c.y * 19349663u ^ (uint32_t)c.z * 83492791u) & mask;
+    }
+
+    uint32_t mask = 0;
+};
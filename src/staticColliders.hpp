@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "al/math/al_Vec.hpp"
+#include "simdKernels.hpp"
+
+using namespace al;
+
+// Static geometry of the scene: half spaces and solid axis-aligned boxes.
+// hits() tests a point set against every collider in one pass, so the
+// boundary costs one read of each point however many colliders there are.
+// The few points it returns are resolved with contacts().
+// Slots are the planes first, then the six faces of each box.
+class StaticColliderSet
+{
+public:
+    std::vector<Vec3f> planeN; // into the free side
+    std::vector<float> planeOffset; // p . N < offset is behind the plane
+    std::vector<Vec3f> boxMin, boxMax;
+
+    void addPlane(Vec3f P, Vec3f N)
+    {
+        N = N.normalize();
+        planeN.push_back(N);
+        planeOffset.push_back(P.dot(N));
+    }
+
+    void addBox(Vec3f min, Vec3f max)
+    {
+        boxMin.push_back(min);
+        boxMax.push_back(max);
+    }
+
+    void clear()
+    {
+        planeN.clear();
+        planeOffset.clear();
+        boxMin.clear();
+        boxMax.clear();
+    }
+
+    int slots() const { return planeN.size() + 6 * boxMin.size(); }
+
+    // direction a slot pushes points out
+    Vec3f normal(int slot) const
+    {
+        if (slot < planeN.size())
+            return planeN[slot];
+        int face = (slot - planeN.size()) % 6;
+        Vec3f N(0);
+        N[face / 2] = face % 2 == 0 ? 1 : -1;
+        return N;
+    }
+
+    // fn(slot, depth) for every slot p is behind, depth being how far p has
+    // to move along normal(slot) to leave. A point inside a box leaves
+    // through the nearest face. p is read again for every collider, so a
+    // fn that moves it is seen by the colliders after
+    template <class F>
+    void contacts(const Vec3f &p, F fn) const
+    {
+        for (int c = 0; c < planeN.size(); c++)
+        {
+            float d = p.x * planeN[c].x + p.y * planeN[c].y + p.z * planeN[c].z;
+            if (d < planeOffset[c])
+                fn(c, planeOffset[c] - d);
+        }
+        for (int c = 0; c < boxMin.size(); c++)
+        {
+            auto &min = boxMin[c];
+            auto &max = boxMax[c];
+            if (!(min.x < p.x && p.x < max.x && min.y < p.y && p.y < max.y && min.z < p.z && p.z < max.z))
+                continue;
+            int nearest = 0;
+            float depth = max[0] - p[0];
+            for (int i = 0; i < 3; i++)
+            {
+                float faceDepth[2] = {max[i] - p[i], p[i] - min[i]};
+                for (int s = 0; s < 2; s++)
+                {
+                    if (faceDepth[s] < depth)
+                    {
+                        nearest = i * 2 + s;
+                        depth = faceDepth[s];
+                    }
+                }
+            }
+            fn(planeN.size() + c * 6 + nearest, depth);
+        }
+    }
+
+    // indices of the points behind any plane or inside any box, ascending
+    int hits(const PointBuffer &points, std::vector<uint32_t> &hit) const
+    {
+        hit.resize(points.size());
+        int i = 0, count = 0;
+#ifdef SIMD_WIDTH
+        for (; i + SIMD_WIDTH <= points.size(); i += SIMD_WIDTH)
+        {
+            simdf x = simdLoad(&points.x[i]), y = simdLoad(&points.y[i]), z = simdLoad(&points.z[i]);
+            simdf any = simdSet(0);
+            for (int c = 0; c < planeN.size(); c++)
+            {
+                simdf d = simdAdd(simdAdd(simdMul(x, simdSet(planeN[c].x)), simdMul(y, simdSet(planeN[c].y))),
+                                  simdMul(z, simdSet(planeN[c].z)));
+                any = simdOr(any, simdLess(d, simdSet(planeOffset[c])));
+            }
+            for (int c = 0; c < boxMin.size(); c++)
+            {
+                simdf in = simdAnd(simdLess(simdSet(boxMin[c].x), x), simdLess(x, simdSet(boxMax[c].x)));
+                in = simdAnd(in, simdAnd(simdLess(simdSet(boxMin[c].y), y), simdLess(y, simdSet(boxMax[c].y))));
+                in = simdAnd(in, simdAnd(simdLess(simdSet(boxMin[c].z), z), simdLess(z, simdSet(boxMax[c].z))));
+                any = simdOr(any, in);
+            }
+            int bits = simdMask(any);
+            for (int k = 0; k < SIMD_WIDTH; k++)
+            {
+                hit[count] = i + k;
+                count += bits >> k & 1;
+            }
+        }
+#endif
+        for (; i < points.size(); i++)
+        {
+            if (inside(points.get(i)))
+                hit[count++] = i;
+        }
+        hit.resize(count);
+        return count;
+    }
+
+    bool inside(const Vec3f &p) const
+    {
+        for (int c = 0; c < planeN.size(); c++)
+        {
+            if (p.x * planeN[c].x + p.y * planeN[c].y + p.z * planeN[c].z < planeOffset[c])
+                return true;
+        }
+        for (int c = 0; c < boxMin.size(); c++)
+        {
+            if (boxMin[c].x < p.x && p.x < boxMax[c].x && boxMin[c].y < p.y && p.y < boxMax[c].y &&
+                boxMin[c].z < p.z && p.z < boxMax[c].z)
+                return true;
+        }
+        return false;
+    }
+};
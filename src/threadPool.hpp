@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the physics code. parallelFor is the
+// only entry point: the calling thread takes indices too, so it is safe to call
+// it again from inside a task (nested loops just run on fewer threads).
+class ThreadPool
+{
+public:
+    ThreadPool(int threadNum = std::thread::hardware_concurrency())
+    {
+        threadNum = std::max(threadNum, 1);
+        // the caller of parallelFor is the last thread
+        for (int i = 0; i < threadNum - 1; i++)
+        {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    int size() const { return workers.size() + 1; }
+
+    // fn(i) for every i in [0, n), returns when all calls are done. Nothing
+    // is allocated: the job lives on the caller's stack, so before returning
+    // the caller takes back the slots no worker has picked up and waits for
+    // the workers that did to leave the job.
+    template <class F>
+    void parallelFor(int n, F fn)
+    {
+        if (n <= 0)
+            return;
+        if (n == 1 || workers.empty())
+        {
+            for (int i = 0; i < n; i++)
+                fn(i);
+            return;
+        }
+        Job job;
+        job.n = n;
+        job.context = &fn;
+        job.call = [](void *context, int i) { (*(F *)context)(i); };
+        int helpers = std::min<int>(n - 1, workers.size());
+        job.pending = helpers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int i = 0; i < helpers; i++)
+                tasks.push_back(&job);
+        }
+        if (helpers == 1)
+            wake.notify_one();
+        else
+            wake.notify_all();
+        job.run();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int queued = tasks.size();
+            tasks.erase(std::remove(tasks.begin(), tasks.end(), &job), tasks.end());
+            job.leave(queued - tasks.size());
+        }
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.finished.wait(lock, [&]() { return job.done == job.n && job.pending == 0; });
+    }
+
+    static ThreadPool &instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    struct Job
+    {
+        int n = 0;
+        void (*call)(void *, int) = nullptr;
+        void *context = nullptr; // the caller's fn
+        std::atomic<int> next{0};
+        int done = 0;
+        int pending = 0; // queued or running helper slots
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        void run()
+        {
+            int count = 0;
+            for (int i = next++; i < n; i = next++)
+            {
+                call(context, i);
+                count++;
+            }
+            if (count == 0)
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            done += count;
+            if (done == n && pending == 0)
+                finished.notify_all();
+        }
+
+        // count helper slots are done with the job; the last touch of it
+        void leave(int count)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending -= count;
+            if (done == n && pending == 0)
+                finished.notify_all();
+        }
+    };
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            Job *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stop || !tasks.empty(); });
+                if (stop && tasks.empty())
+                    return;
+                job = tasks.front();
+                tasks.erase(tasks.begin());
+            }
+            job->run();
+            job->leave(1);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<Job *> tasks; // a few at a time, so a vector keeps its capacity
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+};